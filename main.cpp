@@ -1,56 +1,159 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <string_view>
+#include <array>
+#include <charconv>
+#include <cstring>
 #include <algorithm>
 #include <iomanip>
 #include <ctime>
 #include <sstream>
 #include <limits>
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <shared_mutex>
+#include <random>
+#include <filesystem>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <csignal>
+#include <cerrno>
+#endif
 
 using namespace std;
 
 
 //Utilities 
-static inline string trim(const string &s) {
+static string join(initializer_list<string_view> v, char delim='|') {
+    string s;
+    bool first = true;
+    for (string_view f : v) {
+        if (!first) s.push_back(delim);
+        s += f;
+        first = false;
+    }
+    return s;
+}
+
+static bool isNumber(string_view s) {
+    if (s.empty()) return false;
+    for (char c : s) if (!isdigit((unsigned char)c)) return false;
+    return true;
+}
+
+// True if s can be stored as one field of a '|' record (no delimiter, no line break).
+static bool fitsRecord(string_view s) {
+    return s.find_first_of("|\r\n") == string_view::npos;
+}
+
+// How the batch adds report their first bad row: with badRow, its index goes
+// there and why is just the reason; without, why reads "row <n>: <reason>".
+static void rejectBatchRow(size_t i, const char *reason, string &why, size_t *badRow) {
+    if (badRow) { *badRow = i; why = reason; }
+    else why = "row " + to_string(i + 1) + ": " + reason;
+}
+
+// string_view helpers for the loaders: fields are parsed in place, no heap.
+static inline string_view trimView(string_view s) {
     size_t a = s.find_first_not_of(" \t\r\n");
-    if (a == string::npos) return "";
+    if (a == string_view::npos) return {};
     size_t b = s.find_last_not_of(" \t\r\n");
     return s.substr(a, b - a + 1);
 }
 
-static vector<string> split(const string &line, char delim='|') {
-    vector<string> out; string cur;
-    for (char c : line) {
-        if (c == delim) { out.push_back(cur); cur.clear(); }
-        else cur.push_back(c);
+// Fills up to N fields and returns how many the line actually has.
+template <size_t N>
+static size_t splitFields(string_view line, array<string_view, N> &out, char delim='|') {
+    size_t n = 0, start = 0;
+    while (true) {
+        size_t pos = line.find(delim, start);
+        if (n < N) out[n] = line.substr(start, pos == string_view::npos ? pos : pos - start);
+        ++n;
+        if (pos == string_view::npos) return n;
+        start = pos + 1;
     }
-    out.push_back(cur);
-    return out;
 }
 
-static string join(const vector<string> &v, char delim='|') {
-    string s;
-    for (size_t i=0;i<v.size();++i) {
-        if (i) s.push_back(delim);
-        s += v[i];
-    }
-    return s;
+static bool toInt(string_view s, int &out) {
+    if (!isNumber(s)) return false;
+    auto r = from_chars(s.data(), s.data() + s.size(), out);
+    return r.ec == errc();
 }
 
-static bool isNumber(const string &s) {
-    if (s.empty()) return false;
-    for (char c : s) if (!isdigit((unsigned char)c)) return false;
-    return true;
+static bool toSize(string_view s, size_t &out) {
+    if (!isNumber(s)) return false;
+    auto r = from_chars(s.data(), s.data() + s.size(), out);
+    return r.ec == errc();
+}
+
+static bool toDouble(string_view s, double &out) {
+    auto r = from_chars(s.data(), s.data() + s.size(), out);
+    return !s.empty() && r.ec == errc() && r.ptr == s.data() + s.size() && isfinite(out);
 }
 
 
 // Date Helpers 
+// A Date is packed as days since 1970-01-01 (proleptic Gregorian), so
+// comparing and ordering dates are plain integer ops. Calendar fields are
+// only unpacked for month arithmetic and text I/O.
 struct Date {
-    int y=1970, m=1, d=1;
+    int32_t days = 0;
+
+    static Date invalid() { return Date{numeric_limits<int32_t>::min()}; }
+    bool valid() const { return days != numeric_limits<int32_t>::min(); }
 };
 
+static inline bool operator==(Date a, Date b) { return a.days == b.days; }
+static inline bool operator!=(Date a, Date b) { return a.days != b.days; }
+static inline bool operator<(Date a, Date b)  { return a.days <  b.days; }
+static inline bool operator<=(Date a, Date b) { return a.days <= b.days; }
+
+struct CivilDate { int y, m, d; };
+
+static Date fromCivil(int y, int m, int d) {
+    y -= (m <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return Date{era * 146097 + doe - 719468};
+}
+
+static CivilDate toCivil(Date dt) {
+    int z = dt.days + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int d = doy - (153 * mp + 2) / 5 + 1;
+    int m = mp + (mp < 10 ? 3 : -9);
+    return CivilDate{yoe + era * 400 + (m <= 2), m, d};
+}
+
 static bool isLeap(int y) {
     return (y%400==0) || (y%4==0 && y%100!=0);
 }
@@ -61,61 +164,233 @@ static int daysInMonth(int y, int m) {
     return md[m-1];
 }
 
-static bool parseDate(const string &s, Date &out) {
+static bool parseDate(string_view s, Date &out) {
     if (s.size()!=10 || s[4]!='-' || s[7]!='-') return false;
-    string sy = s.substr(0,4), sm = s.substr(5,2), sd = s.substr(8,2);
-    if (!isNumber(sy) || !isNumber(sm) || !isNumber(sd)) return false;
-    int y = stoi(sy), m = stoi(sm), d = stoi(sd);
+    int y, m, d;
+    if (!toInt(s.substr(0,4), y) || !toInt(s.substr(5,2), m) || !toInt(s.substr(8,2), d)) return false;
     if (m<1 || m>12) return false;
     if (d<1 || d>daysInMonth(y,m)) return false;
-    out.y=y; out.m=m; out.d=d; return true;
+    out = fromCivil(y, m, d);
+    return true;
+}
+
+// Invalid dates (unparseable input kept from old files) print as "".
+// Writes YYYY-MM-DD into out (room for 16 chars); returns the length, 0 if invalid.
+static size_t dateToChars(char *out, Date dt) {
+    if (!dt.valid()) return 0;
+    CivilDate c = toCivil(dt);
+    if (c.y < 0 || c.y > 9999)
+        return (size_t)snprintf(out, 16, "%04d-%02d-%02d", c.y, c.m, c.d);
+    auto two = [](char *p, int v) { p[0] = char('0' + v / 10); p[1] = char('0' + v % 10); };
+    two(out, c.y / 100); two(out + 2, c.y % 100);
+    out[4] = '-'; two(out + 5, c.m);
+    out[7] = '-'; two(out + 8, c.d);
+    return 10;
 }
 
-static string dateToString(const Date &dt) {
-    auto two = [](int v){ string s = to_string(v); if (s.size()==1) s="0"+s; return s; };
-    return to_string(dt.y) + "-" + two(dt.m) + "-" + two(dt.d);
+static string dateToString(Date dt) {
+    char buf[16];
+    return string(buf, dateToChars(buf, dt));
 }
 
 static Date addMonths(Date dt, int months) {
-    int Y = dt.y;
-    int M = dt.m + months;
+    CivilDate c = toCivil(dt);
+    int Y = c.y;
+    int M = c.m + months;
     while (M > 12) { M -= 12; Y++; }
     while (M < 1)  { M += 12; Y--; }
-    int D = min(dt.d, daysInMonth(Y, M));
-    return Date{Y, M, D};
+    int D = min(c.d, daysInMonth(Y, M));
+    return fromCivil(Y, M, D);
 }
 
-static int cmpDate(const Date &a, const Date &b) {
-    if (a.y!=b.y) return a.y<b.y?-1:1;
-    if (a.m!=b.m) return a.m<b.m?-1:1;
-    if (a.d!=b.d) return a.d<b.d?-1:1;
-    return 0;
+static int cmpDate(Date a, Date b) {
+    return a.days < b.days ? -1 : (a.days > b.days ? 1 : 0);
 }
 
 static Date todayApprox() {
     time_t t = time(nullptr);
-    tm *lt = localtime(&t);
-    return Date{1900 + lt->tm_year, 1 + lt->tm_mon, lt->tm_mday};
+    tm lt{};
+#ifdef _WIN32
+    localtime_s(&lt, &t);
+#else
+    localtime_r(&t, &lt);   // loaders call this from pool threads
+#endif
+    return fromCivil(1900 + lt.tm_year, 1 + lt.tm_mon, lt.tm_mday);
+}
+
+// Money Helpers
+// Amounts are int64 minor units (cents): sums are exact and formatting is
+// done once, at output time.
+using Money = int64_t;
+
+// Accepts "1500", "1500.5", "-3.25" and the old "2000.000000" records;
+// fractions beyond cents round half up.
+static bool parseMoney(string_view s, Money &out) {
+    s = trimView(s);
+    bool neg = false;
+    if (!s.empty() && (s[0]=='-' || s[0]=='+')) { neg = s[0]=='-'; s.remove_prefix(1); }
+    size_t dot = s.find('.');
+    string_view whole = s.substr(0, dot);
+    string_view frac = dot == string_view::npos ? string_view() : s.substr(dot + 1);
+    if (whole.empty() && frac.empty()) return false;
+    if ((!whole.empty() && !isNumber(whole)) || (!frac.empty() && !isNumber(frac))) return false;
+    int64_t units = 0;
+    if (!whole.empty()) {
+        auto r = from_chars(whole.data(), whole.data() + whole.size(), units);
+        if (r.ec != errc() || units > numeric_limits<int64_t>::max() / 100 - 1) return false;
+    }
+    int64_t cents = 0;
+    if (frac.size() >= 1) cents += (frac[0] - '0') * 10;
+    if (frac.size() >= 2) cents += frac[1] - '0';
+    if (frac.size() >= 3 && frac[2] >= '5') cents += 1;
+    out = units * 100 + cents;
+    if (neg) out = -out;
+    return true;
+}
+
+// Writes "-123.45" style text into out (room for 32 chars); returns the length.
+static size_t moneyToChars(char *out, Money m) {
+    bool neg = m < 0;
+    uint64_t u = neg ? 0 - (uint64_t)m : (uint64_t)m;
+    char *p = out;
+    if (neg) *p++ = '-';
+    p = to_chars(p, out + 29, u / 100).ptr;
+    unsigned cents = (unsigned)(u % 100);
+    p[0] = '.'; p[1] = char('0' + cents / 10); p[2] = char('0' + cents % 10);
+    return (size_t)(p + 3 - out);
+}
+
+static string moneyToString(Money m) {
+    char buf[32];
+    return string(buf, moneyToChars(buf, m));
+}
+
+// Bulk reductions over contiguous Money columns. Plain counted loops over
+// restrict-qualified arrays, which GCC/Clang vectorise at -O3.
+static Money sumMoney(const Money *__restrict v, size_t n) {
+    Money s = 0;
+    for (size_t i = 0; i < n; ++i) s += v[i];
+    return s;
+}
+
+// Sum of max(0, due[i] - paid[i]).
+static Money sumShortfall(const Money *__restrict due, const Money *__restrict paid, size_t n) {
+    Money s = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Money d = due[i] - paid[i];
+        s += d > 0 ? d : 0;
+    }
+    return s;
 }
 
+//Text storage: entity strings live in an append-only arena, and strings that
+// repeat across rows (policy types, policy IDs referenced by payments) are
+// interned to 32-bit keys. Rows then hold views/keys instead of heap strings.
+class StringArena {
+    static const size_t kBlock = 1 << 20;
+    static mutex& lock() { static mutex m; return m; }
+    static vector<unique_ptr<char[]>>& blocks() { static vector<unique_ptr<char[]>> b; return b; }
+    static char* grab(size_t n) {
+        lock_guard<mutex> lk(lock());
+        blocks().emplace_back(new char[n]);
+        return blocks().back().get();
+    }
+public:
+    // The returned view stays valid for the life of the process. Each thread
+    // carves from its own block, so concurrent loaders do not contend.
+    static string_view store(string_view s) {
+        if (s.empty()) return {};
+        if (s.size() > kBlock / 8) {
+            char *p = grab(s.size());
+            memcpy(p, s.data(), s.size());
+            return string_view(p, s.size());
+        }
+        static thread_local char *cur = nullptr;
+        static thread_local size_t left = 0;
+        if (left < s.size()) { cur = grab(kBlock); left = kBlock; }
+        memcpy(cur, s.data(), s.size());
+        string_view out(cur, s.size());
+        cur += s.size(); left -= s.size();
+        return out;
+    }
+};
+
+class Interner {
+    static const uint32_t kSegBits = 16, kSegs = 4096;   // up to 268M distinct strings
+    mutable shared_mutex mu;
+    unordered_map<string_view, uint32_t> ids;
+    array<atomic<string_view*>, kSegs> segs{};
+    uint32_t count = 0;
+public:
+    Interner() { intern(""); }   // key 0 is the empty string
+    ~Interner() { for (auto &sg : segs) delete[] sg.load(); }
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
+
+    uint32_t intern(string_view s) {
+        {
+            shared_lock<shared_mutex> rl(mu);
+            auto it = ids.find(s);
+            if (it != ids.end()) return it->second;
+        }
+        unique_lock<shared_mutex> wl(mu);
+        auto it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        uint32_t key = count++;
+        string_view *seg = segs[key >> kSegBits].load(memory_order_relaxed);
+        if (!seg) {
+            seg = new string_view[1u << kSegBits];
+            segs[key >> kSegBits].store(seg, memory_order_release);
+        }
+        string_view stored = StringArena::store(s);
+        seg[key & ((1u << kSegBits) - 1)] = stored;
+        ids.emplace(stored, key);
+        return key;
+    }
+
+    bool find(string_view s, uint32_t &key) const {
+        shared_lock<shared_mutex> rl(mu);
+        auto it = ids.find(s);
+        if (it == ids.end()) return false;
+        key = it->second;
+        return true;
+    }
+
+    // Keys handed out so far (all below this value).
+    uint32_t size() const {
+        shared_lock<shared_mutex> rl(mu);
+        return count;
+    }
+
+    // Keys come from intern(), so their segment is already published.
+    string_view str(uint32_t key) const {
+        return segs[key >> kSegBits].load(memory_order_acquire)[key & ((1u << kSegBits) - 1)];
+    }
+};
+
+static Interner& policyTypes() { static Interner i; return i; }
+static Interner& policyIds()   { static Interner i; return i; }
+
+
 //Entities
 class Person {
 protected:
-    string name;
-    string contact;
-    string address;
+    string_view name;      // arena-backed
+    string_view contact;
+    string_view address;
 public:
     Person() {}
-    Person(const string &n, const string &c, const string &a) : name(n), contact(c), address(a) {}
+    Person(string_view n, string_view c, string_view a)
+        : name(StringArena::store(n)), contact(StringArena::store(c)), address(StringArena::store(a)) {}
     virtual ~Person() {}
 
-    string getName() const { return name; }
-    string getContact() const { return contact; }
-    string getAddress() const { return address; }
+    string_view getName() const { return name; }
+    string_view getContact() const { return contact; }
+    string_view getAddress() const { return address; }
 
-    void setName(const string &n) { name = n; }
-    void setContact(const string &c) { contact = c; }
-    void setAddress(const string &a) { address = a; }
+    void setName(string_view n) { name = StringArena::store(n); }
+    void setContact(string_view c) { contact = StringArena::store(c); }
+    void setAddress(string_view a) { address = StringArena::store(a); }
 };
 
 class Client : public Person {
@@ -123,7 +398,7 @@ class Client : public Person {
     int age;
 public:
     Client() : id(0), age(0) {}
-    Client(int i, const string &n, int ag, const string &c, const string &a)
+    Client(int i, string_view n, int ag, string_view c, string_view a)
         : Person(n,c,a), id(i), age(ag) {}
 
     int getId() const { return id; }
@@ -131,18 +406,13 @@ public:
     void setId(int i) { id = i; }
     void setAge(int ag) { age = ag; }
 
-    static Client fromRecord(const string &line) {
-        auto v = split(line, '|');
+    static Client fromRecord(string_view line) {
+        array<string_view, 5> v;
+        size_t n = splitFields(line, v);
         // id|name|age|contact|address
-        Client c;
-        if (v.size()==5 && isNumber(v[0]) && isNumber(v[2])) {
-            c.id = stoi(v[0]);
-            c.name = v[1];
-            c.age = stoi(v[2]);
-            c.contact = v[3];
-            c.address = v[4];
-        }
-        return c;
+        int id, age;
+        if (n==5 && toInt(v[0], id) && toInt(v[2], age)) return Client(id, v[1], age, v[3], v[4]);
+        return Client();
     }
     string toRecord() const {
         return join({to_string(id), name, to_string(age), contact, address}, '|');
@@ -150,449 +420,3612 @@ public:
 };
 
 class Policy {
-    string policyId;
-    string type;
-    double monthlyPremium;
+    uint32_t idKey;     // policyIds() key
+    uint32_t typeKey;   // policyTypes() key
+    Money monthlyPremium;
     int durationMonths;
     int clientId;
-    string startDate;
+    Date startDate;
 public:
-    Policy() : monthlyPremium(0.0), durationMonths(0), clientId(0) {}
+    Policy() : idKey(0), typeKey(0), monthlyPremium(0), durationMonths(0), clientId(0) {}
 
-    string getPolicyId()     const { return policyId; }
-    string getType()         const { return type; }
-    double getPremium()      const { return monthlyPremium; }
+    string_view getPolicyId()  const { return policyIds().str(idKey); }
+    string_view getType()      const { return policyTypes().str(typeKey); }
+    uint32_t getPolicyKey()    const { return idKey; }
+    uint32_t getTypeKey()      const { return typeKey; }
+    Money  getPremium()      const { return monthlyPremium; }
     int    getDuration()     const { return durationMonths; }
     int    getClientId()     const { return clientId; }
-    string getStartDate()    const { return startDate; }
+    Date   getStartDate()    const { return startDate; }
 
-    void setPolicyId(const string &id) { policyId = id; }
-    void setType(const string &t) { type = t; }
-    void setPremium(double p) { monthlyPremium = p; }
+    void setPolicyId(string_view id) { idKey = policyIds().intern(id); }
+    void setType(string_view t) { typeKey = policyTypes().intern(t); }
+    void setPremium(Money p) { monthlyPremium = p; }
     void setDuration(int m) { durationMonths = m; }
     void setClientId(int cid) { clientId = cid; }
-    void setStartDate(const string &sd) { startDate = sd; }
+    void setStartDate(Date sd) { startDate = sd; }
 
-    static Policy fromRecord(const string &line) {
+    static Policy fromRecord(string_view line) {
         // policyId|type|premium|duration|clientId|startDate
-        auto v = split(line, '|');
+        array<string_view, 6> v;
+        size_t n = splitFields(line, v);
         Policy p;
-        if (v.size() >= 5) {
-            p.policyId = v[0];
-            p.type = v[1];
-            p.monthlyPremium = (v.size() >= 3 ? atof(v[2].c_str()) : 0.0);
-            p.durationMonths = (v.size() >= 4 && isNumber(v[3]) ? stoi(v[3]) : 0);
-            p.clientId = (v.size() >= 5 && isNumber(v[4]) ? stoi(v[4]) : 0);
-            if (v.size() >= 6) p.startDate = v[5];
-            else p.startDate = dateToString(todayApprox());
+        if (n >= 5) {
+            p.setPolicyId(v[0]);
+            p.setType(v[1]);
+            if (!parseMoney(v[2], p.monthlyPremium)) p.monthlyPremium = 0;
+            if (!toInt(v[3], p.durationMonths)) p.durationMonths = 0;
+            if (!toInt(v[4], p.clientId)) p.clientId = 0;
+            if (n < 6) p.startDate = todayApprox();
+            else if (!parseDate(v[5], p.startDate)) p.startDate = Date::invalid();
         }
         return p;
     }
     string toRecord() const {
         return join({
-            policyId, type, to_string((long double)monthlyPremium),
-            to_string(durationMonths), to_string(clientId), startDate
+            getPolicyId(), getType(), moneyToString(monthlyPremium),
+            to_string(durationMonths), to_string(clientId), dateToString(startDate)
         }, '|');
     }
 };
 
 class Payment {
-    string policyId;
-    double amount;
-    string date; 
+    uint32_t policyKey;   // policyIds() key, shared with Policy
+    Money amount;
+    Date date;
+public:
+    Payment(): policyKey(0), amount(0) {}
+    Payment(string_view pid, Money amt, Date dt)
+        : policyKey(policyIds().intern(pid)), amount(amt), date(dt) {}
+    Payment(uint32_t key, Money amt, Date dt)
+        : policyKey(key), amount(amt), date(dt) {}
+
+    string_view getPolicyId() const { return policyIds().str(policyKey); }
+    uint32_t getPolicyKey()   const { return policyKey; }
+    Money  getAmount()   const { return amount; }
+    Date   getDate()     const { return date;   }
+
+    void setPolicyId(string_view pid) { policyKey = policyIds().intern(pid); }
+    void setAmount(Money a) { amount = a; }
+    void setDate(Date d) { date = d; }
+
+    static Payment fromRecord(string_view line) {
+        // policyId|amount|date
+        array<string_view, 3> v;
+        size_t n = splitFields(line, v);
+        Payment pm;
+        if (n==3) {
+            pm.setPolicyId(v[0]);
+            if (!parseMoney(v[1], pm.amount)) pm.amount = 0;
+            if (!parseDate(v[2], pm.date)) pm.date = Date::invalid();
+        }
+        return pm;
+    }
+    string toRecord() const {
+        return join({getPolicyId(), moneyToString(amount), dateToString(date)}, '|');
+    }
+};
+
+// s as a JSON string literal, handed to put(string_view) in pieces.
+template <class Put>
+static void jsonQuoted(string_view s, Put put) {
+    put("\"");
+    size_t plain = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char ch = s[i];
+        if (ch != '"' && ch != '\\' && (unsigned char)ch >= 0x20) continue;
+        put(s.substr(plain, i - plain));
+        plain = i + 1;
+        switch (ch) {
+            case '"':  put("\\\""); break;
+            case '\\': put("\\\\"); break;
+            case '\n': put("\\n"); break;
+            case '\r': put("\\r"); break;
+            case '\t': put("\\t"); break;
+            default: {
+                char b[8];
+                snprintf(b, sizeof(b), "\\u%04x", (unsigned)(unsigned char)ch);
+                put(b);
+            }
+        }
+    }
+    put(s.substr(plain));
+    put("\"");
+}
+
+
+//Metrics: per-operation call counts and latency histograms, plus bytes
+// read/written per file. Dumped as JSON from the menu and on exit.
+struct OpStats {
+    // Log-linear buckets: exact below 16ns, then 4 sub-buckets per power of two.
+    static const size_t kBuckets = 256;
+    atomic<uint64_t> count{0}, totalNs{0}, maxNs{0};
+    array<atomic<uint64_t>, kBuckets> buckets{};
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < 16) return (size_t)ns;
+#if defined(__GNUC__)
+        int msb = 63 - __builtin_clzll(ns);
+#else
+        int msb = 4;
+        while (ns >> (msb + 1)) ++msb;
+#endif
+        return 16 + (size_t)(msb - 4) * 4 + (size_t)((ns >> (msb - 2)) & 3);
+    }
+    static uint64_t bucketUpper(size_t b) {
+        if (b < 16) return b;
+        int msb = (int)(b - 16) / 4 + 4;
+        uint64_t sub = (b - 16) % 4;
+        return (1ULL << msb) + ((sub + 1) << (msb - 2)) - 1;
+    }
+
+    void record(uint64_t ns) {
+        count.fetch_add(1, memory_order_relaxed);
+        totalNs.fetch_add(ns, memory_order_relaxed);
+        buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+        uint64_t m = maxNs.load(memory_order_relaxed);
+        while (ns > m && !maxNs.compare_exchange_weak(m, ns, memory_order_relaxed)) {}
+    }
+
+    uint64_t percentile(double q) const {
+        uint64_t n = count.load(memory_order_relaxed);
+        if (!n) return 0;
+        uint64_t target = (uint64_t)ceil(q * n), seen = 0;
+        for (size_t b = 0; b < kBuckets; ++b) {
+            seen += buckets[b].load(memory_order_relaxed);
+            if (seen >= target) return min(bucketUpper(b), maxNs.load(memory_order_relaxed));
+        }
+        return maxNs.load(memory_order_relaxed);
+    }
+};
+
+class Metrics {
+    struct FileIo { uint64_t read = 0, written = 0; };
+    mutex mu;
+    map<string, OpStats> ops;      // map nodes never move, so OpStats& stays valid
+    map<string, FileIo> files;
+public:
+    static Metrics& get() { static Metrics inst; return inst; }
+
+    OpStats& op(const string &name) {
+        lock_guard<mutex> lk(mu);
+        return ops.try_emplace(name).first->second;
+    }
+    void bytesRead(const string &file, uint64_t n) {
+        lock_guard<mutex> lk(mu);
+        files[file].read += n;
+    }
+    void bytesWritten(const string &file, uint64_t n) {
+        lock_guard<mutex> lk(mu);
+        files[file].written += n;
+    }
+
+    void writeJson(ostream &out) {
+        lock_guard<mutex> lk(mu);
+        out << "{\"ops\":{";
+        bool first = true;
+        for (auto &kv : ops) {
+            const OpStats &st = kv.second;
+            out << (first ? "" : ",") << "\n  ";
+            jsonQuoted(kv.first, [&](string_view p) { out << p; });
+            out << ":{\"count\":" << st.count.load()
+                << ",\"total_ns\":" << st.totalNs.load() << ",\"p50_ns\":" << st.percentile(0.50)
+                << ",\"p99_ns\":" << st.percentile(0.99) << ",\"max_ns\":" << st.maxNs.load() << "}";
+            first = false;
+        }
+        out << "\n},\"files\":{";
+        first = true;
+        for (auto &kv : files) {
+            out << (first ? "" : ",") << "\n  ";
+            jsonQuoted(kv.first, [&](string_view p) { out << p; });
+            out << ":{\"bytes_read\":" << kv.second.read
+                << ",\"bytes_written\":" << kv.second.written << "}";
+            first = false;
+        }
+        out << "\n}}\n";
+    }
+};
+
+// Scoped latency sample. Call sites cache their OpStats in a function-local
+// static so the hot path is two clock reads and a few relaxed atomics.
+class OpTimer {
+    OpStats &st;
+    chrono::steady_clock::time_point t0;
+public:
+    explicit OpTimer(OpStats &s) : st(s), t0(chrono::steady_clock::now()) {}
+    ~OpTimer() {
+        st.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+    }
+    OpTimer(const OpTimer&) = delete;
+    OpTimer& operator=(const OpTimer&) = delete;
+};
+
+
+//Thread pool shared by loaders (and anything else that fans out work).
+// parallelFor callers help drain the queue while they wait, so nested use
+// from a pool task cannot deadlock.
+class ThreadPool {
+    mutex mu;
+    condition_variable wake;
+    deque<function<void()>> tasks;
+    vector<thread> workers;
+    bool stopping = false;
+
+    bool runOne() {
+        function<void()> task;
+        {
+            lock_guard<mutex> lk(mu);
+            if (tasks.empty()) return false;
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+        return true;
+    }
+public:
+    explicit ThreadPool(unsigned n) {
+        for (unsigned i = 0; i < n; ++i)
+            workers.emplace_back([this] {
+                for (;;) {
+                    function<void()> task;
+                    {
+                        unique_lock<mutex> lk(mu);
+                        wake.wait(lk, [this] { return stopping || !tasks.empty(); });
+                        if (tasks.empty()) return;
+                        task = move(tasks.front());
+                        tasks.pop_front();
+                    }
+                    task();
+                }
+            });
+    }
+    ~ThreadPool() {
+        { lock_guard<mutex> lk(mu); stopping = true; }
+        wake.notify_all();
+        for (auto &w : workers) w.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Sized to the core count, or INSURANCE_THREADS when set.
+    static ThreadPool& shared() {
+        static ThreadPool pool([] {
+            unsigned n = max(1u, thread::hardware_concurrency());
+            const char *env = getenv("INSURANCE_THREADS");
+            int v;
+            if (env && toInt(env, v) && v > 0) n = (unsigned)v;
+            return n - 1;   // the caller of parallelFor is the last thread
+        }());
+        return pool;
+    }
+
+    // Threads that run work, counting the caller of parallelFor.
+    size_t size() const { return workers.size() + 1; }
+
+    // Runs fn(i) for i in [0, n) and returns once all calls have finished.
+    template <class Fn>
+    void parallelFor(size_t n, Fn fn) {
+        if (n == 0) return;
+        if (n == 1 || workers.empty()) { for (size_t i = 0; i < n; ++i) fn(i); return; }
+        struct Batch { mutex m; condition_variable done; size_t left; };
+        auto batch = make_shared<Batch>();
+        batch->left = n;
+        {
+            lock_guard<mutex> lk(mu);
+            for (size_t i = 0; i < n; ++i)
+                tasks.emplace_back([batch, &fn, i] {
+                    fn(i);
+                    lock_guard<mutex> g(batch->m);
+                    if (--batch->left == 0) batch->done.notify_all();
+                });
+        }
+        wake.notify_all();
+        for (;;) {
+            {
+                lock_guard<mutex> g(batch->m);
+                if (batch->left == 0) return;
+            }
+            if (runOne()) continue;
+            unique_lock<mutex> g(batch->m);
+            batch->done.wait(g, [&] { return batch->left == 0; });
+            return;
+        }
+    }
+};
+
+// Splits [0, n) into about one range per pool thread: fn(begin, end).
+template <class Fn>
+static void parallelRanges(size_t n, size_t minPerRange, Fn fn) {
+    ThreadPool &pool = ThreadPool::shared();
+    size_t parts = max<size_t>(1, min(pool.size() * 2, n / max<size_t>(1, minPerRange)));
+    pool.parallelFor(parts, [&](size_t k) { fn(n * k / parts, n * (k + 1) / parts); });
+}
+
+// Runs fn(begin, end, out) over fixed partitions of `grain` items and returns
+// the partitions' outputs concatenated in partition order, so the result is
+// the same as a serial pass whatever the thread count. Pool threads claim the
+// next unstarted partition from a shared cursor, so threads that finish early
+// take over work the others have not reached (no static per-thread split).
+template <class R, class Fn>
+static vector<R> gatherPartitions(size_t n, size_t grain, Fn fn) {
+    size_t parts = (n + grain - 1) / grain;
+    vector<vector<R>> outs(parts);
+    atomic<size_t> next{0};
+    ThreadPool &pool = ThreadPool::shared();
+    pool.parallelFor(min(parts, pool.size()), [&](size_t) {
+        for (size_t k; (k = next.fetch_add(1, memory_order_relaxed)) < parts; )
+            fn(k * grain, min(n, (k + 1) * grain), outs[k]);
+    });
+    size_t total = 0;
+    for (auto &o : outs) total += o.size();
+    vector<R> all;
+    all.reserve(total);
+    for (auto &o : outs) all.insert(all.end(), make_move_iterator(o.begin()), make_move_iterator(o.end()));
+    return all;
+}
+
+// For reductions: each pool worker folds the partitions it claims into its
+// own accumulator (made by init() on that worker), fn(begin, end, acc), and
+// the accumulators are returned for the caller to merge. Memory follows the
+// thread count rather than the partition count; the merge must not depend on
+// which worker saw which partition.
+template <class Acc, class Init, class Fn>
+static vector<Acc> reducePartitions(size_t n, size_t grain, Init init, Fn fn) {
+    size_t parts = (n + grain - 1) / grain;
+    ThreadPool &pool = ThreadPool::shared();
+    vector<Acc> accs(min(parts, pool.size()));
+    atomic<size_t> next{0};
+    pool.parallelFor(accs.size(), [&](size_t w) {
+        accs[w] = init();
+        for (size_t k; (k = next.fetch_add(1, memory_order_relaxed)) < parts; )
+            fn(k * grain, min(n, (k + 1) * grain), accs[w]);
+    });
+    return accs;
+}
+
+//File loading: map the whole file and hand out trimmed lines as views into it.
+class MappedFile {
+    const char *ptr = nullptr;
+    size_t len = 0;
+    bool opened = false;
+    string fallback;          // used where mmap is unavailable or fails
+#ifndef _WIN32
+    void *map = nullptr;
+#endif
+public:
+    explicit MappedFile(const string &path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        opened = true;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+                map = m; ptr = (const char*)m; len = (size_t)st.st_size;
+            }
+        }
+        ::close(fd);
+        if (map || st.st_size == 0) return;
+#endif
+        ifstream in(path, ios::binary);
+        if (!in) return;
+        opened = true;
+        fallback.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        ptr = fallback.data(); len = fallback.size();
+    }
+    ~MappedFile() {
+#ifndef _WIN32
+        if (map) munmap(map, len);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return opened; }
+    string_view view() const { return string_view(ptr, len); }
+};
+
+template <class Fn>
+static void forEachLineIn(string_view data, Fn fn) {
+    while (!data.empty()) {
+        size_t nl = data.find('\n');
+        string_view line = trimView(data.substr(0, nl));
+        if (!line.empty()) fn(line);
+        if (nl == string_view::npos) break;
+        data.remove_prefix(nl + 1);
+    }
+}
+
+// Calls fn(line) for every non-blank trimmed line; false if the file is missing.
+template <class Fn>
+static bool forEachLine(const string &path, Fn fn) {
+    MappedFile f(path);
+    if (!f.isOpen()) return false;
+    string_view data = f.view();
+    Metrics::get().bytesRead(path, data.size());
+    forEachLineIn(data, fn);
+    return true;
+}
+
+static const size_t kParallelMinBytes = 1 << 20;   // smaller files parse inline
+static const size_t kChunkBytes = 1 << 20;
+
+// Parses a file's records in newline-aligned chunks on the shared pool, then
+// calls emit(T&&) on this thread in file order (so indexing stays serial).
+template <class T, class Parse, class Emit>
+static bool forEachRecord(const string &path, Parse parse, Emit emit) {
+    MappedFile f(path);
+    if (!f.isOpen()) return false;
+    string_view data = f.view();
+    Metrics::get().bytesRead(path, data.size());
+    ThreadPool &pool = ThreadPool::shared();
+    if (data.size() < kParallelMinBytes || pool.size() < 2) {
+        forEachLineIn(data, [&](string_view line) { emit(parse(line)); });
+        return true;
+    }
+    vector<string_view> chunks;
+    while (!data.empty()) {
+        size_t nl = data.size() <= kChunkBytes ? string_view::npos : data.find('\n', kChunkBytes);
+        size_t cut = nl == string_view::npos ? data.size() : nl + 1;
+        chunks.push_back(data.substr(0, cut));
+        data.remove_prefix(cut);
+    }
+    vector<vector<T>> parsed(chunks.size());
+    pool.parallelFor(chunks.size(), [&](size_t i) {
+        parsed[i].reserve(chunks[i].size() / 32);
+        forEachLineIn(chunks[i], [&](string_view line) { parsed[i].push_back(parse(line)); });
+    });
+    for (auto &chunk : parsed) {
+        for (T &rec : chunk) emit(move(rec));
+        vector<T>().swap(chunk);   // release as we go
+    }
+    return true;
+}
+
+
+//Journal (append-only change log kept next to each data file)
+// "+|record" adds or replaces a row, "-|key" removes it. The base file is only
+// rewritten on checkpoint, so a single change costs O(1) I/O.
+// Deferred keeps changes in memory only and writes the table once per batch
+// (see FlushPolicy); a crash loses at most the unflushed batch.
+enum class StorageMode { Rewrite, Journaled, Deferred };
+
+static const size_t kCheckpointMinEntries = 1024;
+
+// When a Deferred service writes: after maxOps pending changes, once the
+// oldest pending change is maxDelay old (checked on each mutation and tick()),
+// or on flush()/destruction. fsync also makes journal appends durable.
+struct FlushPolicy {
+    size_t maxOps = 256;
+    chrono::milliseconds maxDelay{2000};
+    bool fsync = false;
+};
+// Longest maxDelay accepted (one day); larger values would overflow once
+// compared with steady_clock durations.
+static const size_t kMaxFlushDelayMs = 24 * 60 * 60 * 1000;
+
+// Forces a written file to stable storage; returns false if it could not.
+static bool syncFile(const string &path) {
+#ifdef _WIN32
+    (void)path;   // no portable fd-level fsync through iostreams on Windows
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+static bool replaceFile(const string &from, const string &to) {
+#ifdef _WIN32
+    remove(to.c_str());   // rename() does not overwrite on Windows
+#endif
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+class DirtyTracker {
+    size_t pending = 0;
+    chrono::steady_clock::time_point since;
+public:
+    void mark(size_t n = 1) {
+        if (!n) return;
+        if (!pending) since = chrono::steady_clock::now();
+        pending += n;
+    }
+    bool dirty() const { return pending != 0; }
+    bool due(const FlushPolicy &fp) const {
+        return pending && (pending >= fp.maxOps || chrono::steady_clock::now() - since >= fp.maxDelay);
+    }
+    void clear() { pending = 0; }
+};
+
+class Journal {
+    string path, asidePath;
+    ofstream out;
+    size_t entries = 0;
+    bool sync = false;
+public:
+    explicit Journal(const string &baseFile) : path(baseFile + ".journal"), asidePath(path + ".old") {}
+
+    void setSync(bool s) { sync = s; }
+
+    template <class Fn>
+    size_t replay(Fn apply) {
+        entries = 0;
+        forEachLine(path, [&](string_view line) {
+            if (line.size() < 2 || line[1] != '|') return;
+            apply(line[0], line.substr(2));
+            ++entries;
+        });
+        return entries;
+    }
+
+    void append(char op, const string &payload) {
+        if (!out.is_open()) out.open(path, ios::app);
+        out << op << '|' << payload << '\n';
+        out.flush();
+        if (sync) syncFile(path);
+        Metrics::get().bytesWritten(path, payload.size() + 3);
+        ++entries;
+    }
+
+    // A whole batch in one write (and one fsync).
+    void appendAll(char op, const vector<string> &payloads) {
+        if (payloads.empty()) return;
+        if (!out.is_open()) out.open(path, ios::app);
+        uint64_t bytes = 0;
+        for (auto &p : payloads) {
+            out << op << '|' << p << '\n';
+            bytes += p.size() + 3;
+        }
+        out.flush();
+        if (sync) syncFile(path);
+        Metrics::get().bytesWritten(path, bytes);
+        entries += payloads.size();
+    }
+
+    // Checkpoint steps (see TableStore::checkpoint): the log moves to
+    // <journal>.old while the base file is replaced, then is dropped, or
+    // comes back if the base could not be replaced.
+    void setAside() {
+        if (out.is_open()) out.close();
+        if (entries) replaceFile(path, asidePath);
+    }
+    void dropAside() {
+        if (entries) remove(asidePath.c_str());
+        entries = 0;
+    }
+    void restoreAside() {
+        if (entries) replaceFile(asidePath, path);
+    }
+    const string& asideFile() const { return asidePath; }
+
+    // Checkpoint once the log is as long as the base file it sits on
+    // (baseRows: rows at the last checkpoint or load), so each checkpoint is
+    // paid for by as many appends: amortised O(1) per write. Comparing with
+    // the live row count instead would never fire on a table that only grows.
+    // adding = entries about to be appended (a batch checks before writing).
+    bool dueForCheckpoint(size_t baseRows, size_t adding = 0) const {
+        return entries + adding >= max(kCheckpointMinEntries, baseRows);
+    }
+};
+
+// The write path the services share: how a change is persisted under each
+// StorageMode and when the table is checkpointed. The owning service passes
+// in its full rewrite (save), which goes through checkpoint().
+class TableStore {
+    string baseFile, tmpFile;
+    StorageMode mode;
+    Journal journal;
+    FlushPolicy policy;
+    DirtyTracker dirty;
+    size_t baseRows = 0;   // rows in the base file (last checkpoint or load)
+public:
+    TableStore(const string &file, StorageMode m, FlushPolicy fp)
+        : baseFile(file), tmpFile(file + ".tmp"), mode(m), journal(file), policy(fp) { journal.setSync(fp.fsync); }
+
+    // Finishes or undoes a checkpoint cut short by a crash; call before
+    // reading the base file. A journal set aside means <file>.tmp was
+    // complete: it becomes the base if it was not renamed yet, and either way
+    // the old journal is already in the base. A .tmp alone is a partial write.
+    void recover() {
+        error_code ec;
+        bool aside = filesystem::exists(journal.asideFile(), ec);
+        bool tmp = filesystem::exists(tmpFile, ec);
+        if (aside && tmp) replaceFile(tmpFile, baseFile);
+        else if (tmp) remove(tmpFile.c_str());
+        if (aside) remove(journal.asideFile().c_str());
+    }
+
+    // rows: what the base file just loaded held.
+    template <class Fn>
+    void replay(size_t rows, Fn apply) {
+        baseRows = rows;
+        journal.replay(apply);
+    }
+
+    template <class Save>
+    void commit(char op, const string &payload, Save save) {
+        if (mode == StorageMode::Rewrite) { save(); return; }
+        if (mode == StorageMode::Deferred) {
+            dirty.mark();
+            if (dirty.due(policy)) save();
+            return;
+        }
+        journal.append(op, payload);
+        if (journal.dueForCheckpoint(baseRows)) save();
+    }
+    // A batch persists once: a single journal write, or straight to a
+    // checkpoint when the batch would make one due anyway.
+    template <class Save>
+    void commitBatch(const vector<string> &records, Save save) {
+        if (records.empty()) return;
+        if (mode == StorageMode::Rewrite) { save(); return; }
+        if (mode == StorageMode::Deferred) {
+            dirty.mark(records.size());
+            if (dirty.due(policy)) save();
+            return;
+        }
+        if (journal.dueForCheckpoint(baseRows, records.size())) save();
+        else journal.appendAll('+', records);
+    }
+
+    // Pending Deferred changes: written now / if the flush policy says so.
+    template <class Save>
+    void flush(Save save) { if (dirty.dirty()) save(); }
+    template <class Save>
+    void tick(Save save) { if (dirty.due(policy)) save(); }
+    bool dueForFlush() const { return dirty.due(policy); }
+
+    // Rewrites the base file (write(out) emits every record, `rows` rows)
+    // so that a crash at any point loses nothing and replays nothing twice:
+    // <file>.tmp is written and synced, the journal set aside, the .tmp
+    // renamed over the base, and only then the journal dropped (recover()
+    // sorts out each intermediate state). Returns false, with the base file
+    // and journal as they were, if the new file could not be written.
+    template <class Write>
+    bool checkpoint(size_t rows, Write write) {
+        {
+            ofstream out(tmpFile, ios::trunc);
+            write(out);
+            Metrics::get().bytesWritten(baseFile, (uint64_t)max<streamoff>(0, out.tellp()));
+            out.close();
+            if (!out || !syncFile(tmpFile)) { remove(tmpFile.c_str()); return false; }
+        }
+        journal.setAside();
+        if (!replaceFile(tmpFile, baseFile)) {
+            remove(tmpFile.c_str());
+            journal.restoreAside();
+            return false;
+        }
+        journal.dropAside();
+        dirty.clear();
+        baseRows = rows;
+        return true;
+    }
+};
+
+
+//Versioned storage: tables keep their rows in copy-on-write chunks, so a
+// reader can pin a consistent version (a copy of the chunk list) and scan it
+// without holding any lock while writers keep going. A writer only copies a
+// chunk that some pinned version still shares, so a write costs at most one
+// chunk copy no matter how long the report runs.
+template <class T>
+class CowVector {
+public:
+    static const size_t kChunk = 4096;
+private:
+    vector<shared_ptr<vector<T>>> chunks;
+    size_t n = 0;
+
+    vector<T>& own(size_t c) {
+        shared_ptr<vector<T>> &sp = chunks[c];
+        if (sp.use_count() != 1) {
+            auto copy = make_shared<vector<T>>();
+            copy->reserve(kChunk);
+            copy->assign(sp->begin(), sp->end());
+            sp = move(copy);
+        } else {
+            atomic_thread_fence(memory_order_acquire);   // pairs with readers dropping their pin
+        }
+        return *sp;
+    }
+public:
+    class const_iterator {
+        const CowVector *v; size_t i;
+    public:
+        const_iterator(const CowVector *v, size_t i) : v(v), i(i) {}
+        const T& operator*() const { return (*v)[i]; }
+        const T* operator->() const { return &(*v)[i]; }
+        const_iterator& operator++() { ++i; return *this; }
+        bool operator!=(const const_iterator &o) const { return i != o.i; }
+        bool operator==(const const_iterator &o) const { return i == o.i; }
+    };
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, n); }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    const T& operator[](size_t i) const { return (*chunks[i / kChunk])[i % kChunk]; }
+    const T& back() const { return (*this)[n - 1]; }
+
+    // Writable element; unshares its chunk first.
+    T& mut(size_t i) { return own(i / kChunk)[i % kChunk]; }
+
+    void push_back(const T &v) {
+        if (n % kChunk == 0) {
+            chunks.push_back(make_shared<vector<T>>());
+            chunks.back()->reserve(kChunk);
+        }
+        own(n / kChunk).push_back(v);
+        ++n;
+    }
+    void clear() { chunks.clear(); n = 0; }
+    void reserve(size_t m) { chunks.reserve((m + kChunk - 1) / kChunk); }
+    // Grows to m elements; new ones are copies of fill.
+    void resize(size_t m, const T &fill = T()) {
+        reserve(m);
+        while (n < m) {
+            if (n % kChunk == 0) {
+                chunks.push_back(make_shared<vector<T>>());
+                chunks.back()->reserve(kChunk);
+            }
+            vector<T> &c = own(n / kChunk);
+            size_t k = min(m - n, kChunk - c.size());
+            c.insert(c.end(), k, fill);
+            n += k;
+        }
+    }
+    // Drops the matching elements. Survivors are repacked into fresh chunks,
+    // so pinned versions are never touched.
+    template <class Pred>
+    size_t eraseIf(Pred pred) {
+        CowVector kept;
+        kept.reserve(n);
+        for (size_t i = 0; i < n; ++i) if (!pred((*this)[i])) kept.push_back((*this)[i]);
+        size_t removed = n - kept.n;
+        *this = move(kept);
+        return removed;
+    }
+    // fn(const T *data, size_t count) per chunk, in order (for bulk reductions).
+    template <class Fn>
+    void forEachChunk(Fn fn) const {
+        for (size_t c = 0; c < chunks.size(); ++c) fn(chunks[c]->data(), chunks[c]->size());
+    }
+};
+
+static const uint32_t kNoRow = UINT32_MAX;
+
+// Open-addressing int64 -> row map over a CowVector, so a pinned version of a
+// table pins its primary-key index with it. Grows by rebuilding at half load.
+class CowIndex {
+    struct Slot { int64_t key; uint32_t row; };
+    CowVector<Slot> slots;
+    size_t used = 0;
+
+    static size_t hashOf(int64_t k) {
+        uint64_t x = (uint64_t)k * 0x9E3779B97F4A7C15ull;
+        return (size_t)(x ^ (x >> 29));
+    }
+    void rebuild(size_t cap) {
+        CowVector<Slot> old = move(slots);
+        slots = CowVector<Slot>();
+        slots.resize(cap, Slot{0, kNoRow});
+        used = 0;
+        for (size_t i = 0; i < old.size(); ++i) if (old[i].row != kNoRow) insert(old[i].key, old[i].row);
+    }
+public:
+    size_t size() const { return used; }
+    bool find(int64_t key, uint32_t &row) const {
+        size_t cap = slots.size();
+        if (!cap) return false;
+        for (size_t i = hashOf(key) & (cap - 1);; i = (i + 1) & (cap - 1)) {
+            const Slot &s = slots[i];
+            if (s.row == kNoRow) return false;
+            if (s.key == key) { row = s.row; return true; }
+        }
+    }
+    // Like map::emplace: keeps an existing entry, false if the key was present.
+    bool insert(int64_t key, uint32_t row) {
+        if ((used + 1) * 2 > slots.size()) rebuild(max<size_t>(16, slots.size() * 2));
+        size_t cap = slots.size();
+        for (size_t i = hashOf(key) & (cap - 1);; i = (i + 1) & (cap - 1)) {
+            const Slot &s = slots[i];
+            if (s.row == kNoRow) { slots.mut(i) = Slot{key, row}; ++used; return true; }
+            if (s.key == key) return false;
+        }
+    }
+    void clear() { slots.clear(); used = 0; }
+    void reserve(size_t m) {
+        size_t cap = 16;
+        while (cap < m * 2) cap *= 2;
+        if (cap > slots.size()) rebuild(cap);
+    }
+};
+
+//Binary snapshot: a columnar copy of one table, written on checkpoint and
+// preferred at startup while it is at least as new as the text file.
+// Layout: SnapHeader, then columns. A column is a u64 byte count, the raw
+// values, and padding to 8 bytes. A string column is a u64 end-offset column
+// followed by a char heap column.
+static const char kSnapMagic[8] = {'I','N','S','S','N','A','P','\0'};
+static const uint32_t kSnapVersion = 2;   // 2: money columns are int64 cents
+
+enum class SnapTable : uint32_t { Clients = 1, Policies = 2, Payments = 3 };
+
+struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t table;
+    uint64_t rows;
+    uint64_t textSize;   // size of the text file this snapshot mirrors
+};
+
+class SnapshotWriter {
+    string path, tmpPath;
+    ofstream out;
+
+    void raw(const void *p, uint64_t n) {
+        out.write((const char*)p, (streamsize)n);
+        static const char zeros[8] = {};
+        if (n % 8) out.write(zeros, (streamsize)(8 - n % 8));
+    }
 public:
-    Payment(): amount(0.0) {}
-    Payment(const string &pid, double amt, const string &dt)
-        : policyId(pid), amount(amt), date(dt) {}
+    SnapshotWriter(const string &textFile, SnapTable t, uint64_t rows)
+        : path(textFile + ".snap"), tmpPath(textFile + ".snap.tmp"), out(tmpPath, ios::binary | ios::trunc) {
+        error_code ec;
+        uintmax_t textSize = filesystem::file_size(textFile, ec);
+        SnapHeader h{};
+        memcpy(h.magic, kSnapMagic, sizeof(h.magic));
+        h.version = kSnapVersion;
+        h.table = (uint32_t)t;
+        h.rows = rows;
+        h.textSize = ec ? 0 : (uint64_t)textSize;
+        out.write((const char*)&h, sizeof(h));
+    }
+
+    template <class T>
+    void column(const vector<T> &v) {
+        uint64_t n = v.size() * sizeof(T);
+        out.write((const char*)&n, sizeof(n));
+        raw(v.data(), n);
+    }
+    template <class T>
+    void column(const CowVector<T> &v) {
+        uint64_t n = v.size() * sizeof(T);
+        out.write((const char*)&n, sizeof(n));
+        v.forEachChunk([&](const T *p, size_t c) { out.write((const char*)p, (streamsize)(c * sizeof(T))); });
+        static const char zeros[8] = {};
+        if (n % 8) out.write(zeros, (streamsize)(8 - n % 8));
+    }
 
-    string getPolicyId() const { return policyId; }
-    double getAmount()   const { return amount; }
-    string getDate()     const { return date;   }
+    void strings(const vector<string_view> &v) {
+        vector<uint64_t> ends;
+        ends.reserve(v.size());
+        uint64_t total = 0;
+        for (auto sv : v) ends.push_back(total += sv.size());
+        column(ends);
+        out.write((const char*)&total, sizeof(total));
+        for (auto sv : v) out.write(sv.data(), (streamsize)sv.size());
+        static const char zeros[8] = {};
+        if (total % 8) out.write(zeros, (streamsize)(8 - total % 8));
+    }
+
+    bool commit() {
+        Metrics::get().bytesWritten(path, (uint64_t)max<streamoff>(0, out.tellp()));
+        out.close();
+        if (!out) { remove(tmpPath.c_str()); return false; }
+        return replaceFile(tmpPath, path);
+    }
+};
+
+class SnapshotReader {
+    MappedFile file;
+    string_view data;
+    size_t pos = 0;
+    uint64_t nrows = 0;
+    bool good = false;
+
+    bool block(uint64_t &n, const char *&p) {
+        if (data.size() - pos < sizeof(uint64_t)) return false;
+        memcpy(&n, data.data() + pos, sizeof(n));
+        pos += sizeof(n);
+        uint64_t padded = (n + 7) / 8 * 8;
+        if (data.size() - pos < padded) return false;
+        p = data.data() + pos;
+        pos += padded;
+        return true;
+    }
+public:
+    SnapshotReader(const string &textFile, SnapTable t) : file(textFile + ".snap") {
+        if (!file.isOpen()) return;
+        data = file.view();
+        SnapHeader h;
+        if (data.size() < sizeof(h)) return;
+        memcpy(&h, data.data(), sizeof(h));
+        pos = sizeof(h);
+        if (memcmp(h.magic, kSnapMagic, sizeof(h.magic)) != 0 || h.version != kSnapVersion
+            || h.table != (uint32_t)t) return;
+
+        // Only trust it if the text file is unchanged since the snapshot was taken.
+        error_code e1, e2, e3;
+        uintmax_t textSize = filesystem::file_size(textFile, e1);
+        auto textTime = filesystem::last_write_time(textFile, e2);
+        auto snapTime = filesystem::last_write_time(textFile + ".snap", e3);
+        if (e1 || e2 || e3 || textSize != h.textSize || snapTime < textTime) return;
+        nrows = h.rows;
+        good = true;
+        Metrics::get().bytesRead(textFile + ".snap", data.size());
+    }
+
+    bool ok() const { return good; }
+    uint64_t rows() const { return nrows; }
+
+    template <class T>
+    bool column(vector<T> &out) {
+        uint64_t n; const char *p;
+        if (!good || !block(n, p) || n != nrows * sizeof(T)) return good = false;
+        out.resize(nrows);
+        memcpy(out.data(), p, n);
+        return true;
+    }
+
+    // Views point into the mapped file and live as long as the reader.
+    bool strings(vector<string_view> &out) {
+        vector<uint64_t> ends;
+        uint64_t n; const char *heap;
+        if (!column(ends) || !block(n, heap)) return good = false;
+        out.clear();
+        out.reserve(nrows);
+        uint64_t start = 0;
+        for (uint64_t e : ends) {
+            if (e < start || e > n) return good = false;
+            out.emplace_back(heap + start, e - start);
+            start = e;
+        }
+        return true;
+    }
+};
+
+
+//Services (Main functions for my app)
+
+// Case-folded trigram index over client names, keyed by client id.
+// A substring query intersects the posting lists of the needle's trigrams and
+// only verifies the survivors, so cost follows the candidate count.
+class NameIndex {
+    unordered_map<int, string> folded;            // id -> lowercased name
+    unordered_map<uint32_t, vector<int>> grams;   // trigram -> sorted ids
+    set<pair<string, int>> ordered;               // (folded name, id) for prefixes
+
+    static string fold(string_view s) {
+        string out(s);
+        transform(out.begin(), out.end(), out.begin(), ::tolower);
+        return out;
+    }
+    static vector<uint32_t> trigrams(const string &f) {
+        vector<uint32_t> keys;
+        for (size_t i = 0; i + 3 <= f.size(); ++i)
+            keys.push_back((uint32_t)(unsigned char)f[i] << 16 | (uint32_t)(unsigned char)f[i+1] << 8
+                           | (unsigned char)f[i+2]);
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
+public:
+    static const size_t kMinGram = 3;
+
+    void clear() { folded.clear(); grams.clear(); ordered.clear(); }
+
+    void add(int id, string_view name) {
+        string f = fold(name);
+        for (uint32_t k : trigrams(f)) {
+            vector<int> &ids = grams[k];
+            if (ids.empty() || ids.back() < id) ids.push_back(id);
+            else ids.insert(lower_bound(ids.begin(), ids.end(), id), id);
+        }
+        ordered.emplace(f, id);
+        folded[id] = move(f);
+    }
+
+    void remove(int id) {
+        auto it = folded.find(id);
+        if (it == folded.end()) return;
+        for (uint32_t k : trigrams(it->second)) {
+            auto g = grams.find(k);
+            if (g == grams.end()) continue;
+            auto pos = lower_bound(g->second.begin(), g->second.end(), id);
+            if (pos != g->second.end() && *pos == id) g->second.erase(pos);
+            if (g->second.empty()) grams.erase(g);
+        }
+        ordered.erase({it->second, id});
+        folded.erase(it);
+    }
+
+    const string* foldedName(int id) const {
+        auto it = folded.find(id);
+        return it == folded.end() ? nullptr : &it->second;
+    }
+
+    // Ids (ascending) whose name contains kw; needs kw.size() >= kMinGram.
+    vector<int> contains(const string &kw, size_t limit) const {
+        vector<int> out;
+        string needle = fold(kw);
+        vector<const vector<int>*> lists;
+        for (uint32_t k : trigrams(needle)) {
+            auto g = grams.find(k);
+            if (g == grams.end()) return out;
+            lists.push_back(&g->second);
+        }
+        sort(lists.begin(), lists.end(), [](const vector<int> *a, const vector<int> *b){ return a->size() < b->size(); });
+        for (int id : *lists[0]) {
+            bool all = true;
+            for (size_t i = 1; i < lists.size() && all; ++i)
+                all = binary_search(lists[i]->begin(), lists[i]->end(), id);
+            if (!all || folded.at(id).find(needle) == string::npos) continue;
+            out.push_back(id);
+            if (out.size() >= limit) break;
+        }
+        return out;
+    }
+
+    // Ids whose name starts with prefix, in name order.
+    vector<int> startsWith(const string &prefix, size_t limit) const {
+        vector<int> out;
+        string p = fold(prefix);
+        for (auto it = ordered.lower_bound({p, numeric_limits<int>::min()});
+             it != ordered.end() && out.size() < limit && it->first.compare(0, p.size(), p) == 0; ++it)
+            out.push_back(it->second);
+        return out;
+    }
+};
+
+class ClientService {
+public:
+    // One published version of the table. Copying it (pin()) is cheap and the
+    // copy stays unchanged while the service moves on.
+    struct View {
+        CowVector<Client> rows;
+        CowIndex byId;   // client id -> row
+        const Client* findById(int id) const {
+            uint32_t r;
+            return byId.find(id, r) ? &rows[r] : nullptr;
+        }
+    };
+private:
+    View cur;
+    NameIndex names;    // keyed by id, so it survives row reshuffles (live reads only)
+    string filename;
+    TableStore store;
+    int lastId = 1000;   // highest id seen since load; ids are never handed out twice
+
+    Client* rowFor(int id) {
+        uint32_t r;
+        return cur.byId.find(id, r) ? &cur.rows.mut(r) : nullptr;
+    }
+    void pushRow(const Client &c) {
+        lastId = max(lastId, c.getId());
+        uint32_t row = (uint32_t)cur.rows.size();
+        cur.rows.push_back(c);
+        if (cur.byId.insert(c.getId(), row)) names.add(c.getId(), c.getName());
+    }
+    void reindex() {
+        cur.byId.clear();
+        cur.byId.reserve(cur.rows.size());
+        for (size_t i = 0; i < cur.rows.size(); ++i) cur.byId.insert(cur.rows[i].getId(), (uint32_t)i);
+    }
+    void upsert(const Client &c) {
+        if (Client *x = rowFor(c.getId())) {
+            names.remove(x->getId());
+            *x = c;
+            names.add(x->getId(), x->getName());
+            return;
+        }
+        pushRow(c);
+    }
+    bool erase(int id) {
+        if (!cur.findById(id)) return false;
+        cur.rows.eraseIf([&](const Client &c){ return c.getId()==id; });
+        names.remove(id);
+        reindex();
+        return true;
+    }
+    vector<const Client*> toClients(const vector<int> &ids) const {
+        vector<const Client*> out;
+        out.reserve(ids.size());
+        for (int id : ids) if (const Client *c = cur.findById(id)) out.push_back(c);
+        return out;
+    }
+    void commit(char op, const string &payload) { store.commit(op, payload, [this] { save(); }); }
+    void commitBatch(const vector<string> &records) { store.commitBatch(records, [this] { save(); }); }
+public:
+    // loadNow=false leaves the table empty until load() (used to load tables concurrently).
+    ClientService(const string &file="clients.txt", StorageMode m=StorageMode::Journaled,
+                  FlushPolicy fp=FlushPolicy(), bool loadNow=true)
+        : filename(file), store(file, m, fp) {
+        if (loadNow) load();
+    }
+    ~ClientService() { flush(); }
+
+    bool loadSnapshot() {
+        SnapshotReader r(filename, SnapTable::Clients);
+        vector<int32_t> ids, ages;
+        vector<string_view> nameCol, contacts, addrs;
+        if (!r.column(ids) || !r.column(ages) || !r.strings(nameCol)
+            || !r.strings(contacts) || !r.strings(addrs)) return false;
+        vector<Client> rows(ids.size());
+        parallelRanges(rows.size(), 16384, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) rows[i] = Client(ids[i], nameCol[i], ages[i], contacts[i], addrs[i]);
+        });
+        cur.rows.reserve(rows.size());
+        cur.byId.reserve(rows.size());
+        for (auto &c : rows) pushRow(c);
+        return true;
+    }
+
+    void saveSnapshot() const {
+        SnapshotWriter w(filename, SnapTable::Clients, cur.rows.size());
+        vector<int32_t> ids, ages;
+        vector<string_view> nameCol, contacts, addrs;
+        for (auto &c : cur.rows) {
+            ids.push_back(c.getId()); ages.push_back(c.getAge());
+            nameCol.push_back(c.getName()); contacts.push_back(c.getContact()); addrs.push_back(c.getAddress());
+        }
+        w.column(ids); w.column(ages);
+        w.strings(nameCol); w.strings(contacts); w.strings(addrs);
+        w.commit();
+    }
+
+    void load() {
+        static OpStats &stats = Metrics::get().op("clients.load"); OpTimer t(stats);
+        store.recover();
+        cur = View();
+        names.clear();
+        lastId = 1000;
+        if (!loadSnapshot()) {
+            cur = View();
+            names.clear();
+            lastId = 1000;
+            if (forEachRecord<Client>(filename, Client::fromRecord, [&](Client &&c) { pushRow(c); }))
+                saveSnapshot();
+        }
+        store.replay(cur.rows.size(), [&](char op, string_view rec) {
+            int id;
+            if (op == '+') upsert(Client::fromRecord(rec));
+            else if (op == '-' && toInt(rec, id)) erase(id);
+        });
+    }
+    
+    // Full rewrite; doubles as the journal checkpoint.
+    void save() {
+        static OpStats &stats = Metrics::get().op("clients.save"); OpTimer t(stats);
+        if (store.checkpoint(cur.rows.size(), [&](ostream &out) {
+                for (auto &c : cur.rows) out << c.toRecord() << "\n";
+            })) saveSnapshot();
+    }
+
+    // Writes pending Deferred changes now / if the flush policy says so.
+    void flush() { store.flush([this] { save(); }); }
+    void tick() { store.tick([this] { save(); }); }
+    bool dueForFlush() const { return store.dueForFlush(); }
+
+    int nextId() const { return lastId + 1; }
+
+    bool addClient(const string &name, int age, const string &contact, const string &addr, int &outId) {
+        static OpStats &stats = Metrics::get().op("clients.addClient"); OpTimer t(stats);
+        Client c(nextId(), name, age, contact, addr);
+        upsert(c);
+        commit('+', c.toRecord());
+        outId = c.getId();
+        return true;
+    }
+
+    // Onboarding path: the whole batch is checked first and nothing is added if
+    // any row is bad (see rejectBatchRow for how it is named). Ids are
+    // assigned into batch.
+    bool addClients(vector<Client> &batch, string &why, size_t *badRow = nullptr) {
+        static OpStats &stats = Metrics::get().op("clients.addClients"); OpTimer t(stats);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Client &c = batch[i];
+            const char *bad = c.getName().empty() ? "empty name"
+                            : c.getAge() < 0 || c.getAge() > 150 ? "age out of range"
+                            : !fitsRecord(c.getName()) || !fitsRecord(c.getContact()) || !fitsRecord(c.getAddress())
+                              ? "'|' or line break in a field" : nullptr;
+            if (bad) { rejectBatchRow(i, bad, why, badRow); return false; }
+        }
+        vector<string> records;
+        records.reserve(batch.size());
+        cur.rows.reserve(cur.rows.size() + batch.size());
+        cur.byId.reserve(cur.byId.size() + batch.size());
+        for (auto &c : batch) {
+            c.setId(nextId());
+            pushRow(c);
+            records.push_back(c.toRecord());
+        }
+        commitBatch(records);
+        return true;
+    }
+
+    const Client* findById(int id) const {
+        static OpStats &stats = Metrics::get().op("clients.findById"); OpTimer t(stats);
+        return cur.findById(id);
+    }
+
+    vector<const Client*> findByName(const string &kw, size_t limit = SIZE_MAX) const {
+        static OpStats &stats = Metrics::get().op("clients.findByName"); OpTimer t(stats);
+        if (kw.size() >= NameIndex::kMinGram) return toClients(names.contains(kw, limit));
+        // Too short for trigrams: scan the pre-folded names (no per-row copies).
+        vector<const Client*> out;
+        string needle = kw; transform(needle.begin(), needle.end(), needle.begin(), ::tolower);
+        for (auto &c : cur.rows) {
+            if (out.size() >= limit) break;
+            const string *n = names.foldedName(c.getId());
+            if (n && n->find(needle) != string::npos) out.push_back(&c);
+        }
+        return out;
+    }
+
+    vector<const Client*> findByNamePrefix(const string &prefix, size_t limit = SIZE_MAX) const {
+        static OpStats &stats = Metrics::get().op("clients.findByNamePrefix"); OpTimer t(stats);
+        return toClients(names.startsWith(prefix, limit));
+    }
+
+    bool updateClient(int id, const string &name, const string &ageStr,const string &contact, const string &addr) {
+        static OpStats &stats = Metrics::get().op("clients.updateClient"); OpTimer t(stats);
+        Client *c = rowFor(id);
+        if (!c) return false;
+        if (!name.empty()) {
+            c->setName(name);
+            names.remove(id);
+            names.add(id, name);
+        }
+        if (!ageStr.empty() && isNumber(ageStr)) c->setAge(stoi(ageStr));
+        if (!contact.empty()) c->setContact(contact);
+        if (!addr.empty()) c->setAddress(addr);
+        commit('+', c->toRecord());
+        return true;
+    }
+
+    bool removeClient(int id, bool hasPolicies) {
+        static OpStats &stats = Metrics::get().op("clients.removeClient"); OpTimer t(stats);
+        if (hasPolicies) return false;
+        if (!erase(id)) return false;
+        commit('-', to_string(id));
+        return true;
+    }
+
+    const CowVector<Client>& getAll() const { return cur.rows; }
+
+    // The current version, pinned: later writes do not show through it.
+    View pin() const { return cur; }
+    const View& view() const { return cur; }
+};
+
+static int approxMonthsPaid(Money monthlyPremium, Money totalPaid) {
+    if (monthlyPremium <= 0) return 0;
+    if (totalPaid >= 0) return (int)(totalPaid / monthlyPremium);
+    return (int)-((-totalPaid + monthlyPremium - 1) / monthlyPremium);   // floor
+}
+
+// Everything the status screens show for one policy.
+struct PolicyStatus {
+    Money totalDue = 0, paid = 0, remaining = 0;
+    int monthsPaid = 0;
+    Date nextDue = Date::invalid();   // invalid: fully paid or no valid start
+    Date end = Date::invalid();       // invalid: no valid start
+};
+
+// PolicyStatus per policy key, computed on first use. PolicyService and
+// PaymentService drop a key's entry whenever that policy or its payments
+// change. An entry also records the inputs it came from and is only reused
+// while they match, so a report reading an older pinned version never gets
+// figures from a newer one. Locks are striped by key, so report partitions
+// running in parallel rarely meet on the same one. Keys are dense, so each
+// shard is a plain array indexed by key / kShards.
+class PolicyStatusCache {
+    struct Entry {
+        bool filled = false;
+        Money premium = 0, paid = 0;
+        Date start;
+        int duration = 0;
+        PolicyStatus st;
+    };
+    struct Shard {
+        mutex mu;
+        vector<Entry> entries;
+    };
+    static const size_t kShards = 64;
+    mutable array<Shard, kShards> shards;
+public:
+    // Cheaper than a cache lookup; callers that need nothing else use it directly.
+    static Money remaining(const Policy &p, Money paid) {
+        return max<Money>(0, p.getPremium() * p.getDuration() - paid);
+    }
+
+    static PolicyStatus compute(const Policy &p, Money paid) {
+        PolicyStatus st;
+        st.totalDue = p.getPremium() * p.getDuration();
+        st.paid = paid;
+        st.remaining = remaining(p, paid);
+        st.monthsPaid = approxMonthsPaid(p.getPremium(), paid);
+        Date sd = p.getStartDate();
+        if (sd.valid()) {
+            st.end = addMonths(sd, p.getDuration());
+            if (st.monthsPaid < p.getDuration()) st.nextDue = addMonths(sd, st.monthsPaid + 1);
+        }
+        return st;
+    }
+
+    // paid = the policy's payment total in the same version as p.
+    PolicyStatus get(const Policy &p, Money paid) const {
+        uint32_t key = p.getPolicyKey();
+        Shard &sh = shards[key % kShards];
+        size_t slot = key / kShards;
+        lock_guard<mutex> lk(sh.mu);
+        if (slot >= sh.entries.size()) sh.entries.resize(max<size_t>(slot + 1, sh.entries.size() * 2));
+        Entry &e = sh.entries[slot];
+        if (!e.filled || e.paid != paid || e.premium != p.getPremium() || e.duration != p.getDuration()
+            || e.start != p.getStartDate()) {
+            e.filled = true;
+            e.premium = p.getPremium(); e.paid = paid; e.start = p.getStartDate(); e.duration = p.getDuration();
+            e.st = compute(p, paid);
+        }
+        return e.st;
+    }
+
+    void invalidate(uint32_t key) {
+        Shard &sh = shards[key % kShards];
+        size_t slot = key / kShards;
+        lock_guard<mutex> lk(sh.mu);
+        if (slot < sh.entries.size()) sh.entries[slot].filled = false;
+    }
+};
+
+class PolicyService {
+public:
+    // One published version of the table (see ClientService::View).
+    struct View {
+        CowVector<Policy> rows;
+        CowVector<uint32_t> rowOfKey;   // interned policy id -> row, kNoRow if none
+        const Policy* findByKey(uint32_t key) const {
+            return key < rowOfKey.size() && rowOfKey[key] != kNoRow ? &rows[rowOfKey[key]] : nullptr;
+        }
+        const Policy* findByPolicyId(string_view pid) const {
+            uint32_t key;
+            return policyIds().find(pid, key) ? findByKey(key) : nullptr;
+        }
+    };
+private:
+    View cur;
+    multimap<Date, uint32_t> byEndDate;   // end date -> row, for expiry range scans (live reads only)
+    // Client id -> chain of that client's rows in ascending order, threaded
+    // through nextOfClient (live reads only).
+    struct RowChain { uint32_t head = kNoRow, tail = kNoRow; };
+    unordered_map<int, RowChain> rowsOfClient;
+    vector<uint32_t> nextOfClient;
+    string filename;
+    TableStore store;
+    PolicyStatusCache *statusCache = nullptr;
+    int64_t lastNum = 1000;   // highest "P<n>" seen since load; ids are never handed out twice
+
+    void invalidateStatus(uint32_t key) { if (statusCache) statusCache->invalidate(key); }
+
+    void addEndIndex(uint32_t row) {
+        Date ed;
+        if (policyEndDate(cur.rows[row], ed)) byEndDate.emplace(ed, row);
+    }
+    void dropEndIndex(uint32_t row) {
+        Date ed;
+        if (!policyEndDate(cur.rows[row], ed)) return;
+        auto range = byEndDate.equal_range(ed);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second == row) { byEndDate.erase(it); return; }
+    }
+    // New rows are the highest, so they normally go on the tail.
+    void addClientIndex(uint32_t row) {
+        if (row >= nextOfClient.size()) nextOfClient.resize(max<size_t>(row + 1, nextOfClient.size() * 2), kNoRow);
+        nextOfClient[row] = kNoRow;
+        RowChain &c = rowsOfClient[cur.rows[row].getClientId()];
+        if (c.tail == kNoRow) { c.head = c.tail = row; return; }
+        if (c.tail < row) { nextOfClient[c.tail] = row; c.tail = row; return; }
+        if (row < c.head) { nextOfClient[row] = c.head; c.head = row; return; }
+        uint32_t at = c.head;
+        while (nextOfClient[at] < row) at = nextOfClient[at];
+        nextOfClient[row] = nextOfClient[at];
+        nextOfClient[at] = row;
+    }
+    void dropClientIndex(uint32_t row) {
+        auto it = rowsOfClient.find(cur.rows[row].getClientId());
+        if (it == rowsOfClient.end()) return;
+        RowChain &c = it->second;
+        uint32_t prev = kNoRow;
+        for (uint32_t r = c.head; r != kNoRow; prev = r, r = nextOfClient[r]) {
+            if (r != row) continue;
+            if (prev == kNoRow) c.head = nextOfClient[r]; else nextOfClient[prev] = nextOfClient[r];
+            if (c.tail == row) c.tail = prev;
+            break;
+        }
+        if (c.head == kNoRow) rowsOfClient.erase(it);
+    }
+    void indexRow(uint32_t row) {
+        uint32_t key = cur.rows[row].getPolicyKey();
+        if (key >= cur.rowOfKey.size()) cur.rowOfKey.resize(max<size_t>(key + 1, cur.rowOfKey.size() * 2), kNoRow);
+        if (cur.rowOfKey[key] == kNoRow) cur.rowOfKey.mut(key) = row;
+        addEndIndex(row);
+        addClientIndex(row);
+    }
+    // Numbers past int64 (or at its limit, where +1 would overflow) are
+    // ignored: nextPolicyId() can never produce them anyway.
+    void noteId(string_view pid) {
+        if (pid.empty() || (pid[0] != 'P' && pid[0] != 'p') || !isNumber(pid.substr(1))) return;
+        int64_t num;
+        auto r = from_chars(pid.data() + 1, pid.data() + pid.size(), num);
+        if (r.ec == errc() && num < numeric_limits<int64_t>::max()) lastNum = max(lastNum, num);
+    }
+    void pushRow(const Policy &p) {
+        noteId(p.getPolicyId());
+        cur.rows.push_back(p);
+        indexRow((uint32_t)cur.rows.size() - 1);
+    }
+    void reindex() {
+        cur.rowOfKey.clear();
+        byEndDate.clear();
+        rowsOfClient.clear();
+        nextOfClient.clear();
+        for (size_t i = 0; i < cur.rows.size(); ++i) indexRow((uint32_t)i);
+    }
+    uint32_t rowFor(string_view pid) const {
+        uint32_t key;
+        if (!policyIds().find(pid, key) || key >= cur.rowOfKey.size()) return kNoRow;
+        return cur.rowOfKey[key];
+    }
+    void upsert(const Policy &p) {
+        uint32_t key = p.getPolicyKey();
+        invalidateStatus(key);
+        if (cur.findByKey(key)) {
+            uint32_t row = cur.rowOfKey[key];
+            dropEndIndex(row);
+            dropClientIndex(row);
+            cur.rows.mut(row) = p;
+            addEndIndex(row);
+            addClientIndex(row);
+            return;
+        }
+        pushRow(p);
+    }
+    bool erase(string_view pid) {
+        uint32_t key;
+        if (!policyIds().find(pid, key) || !cur.findByKey(key)) return false;
+        cur.rows.eraseIf([&](const Policy &p){ return p.getPolicyKey()==key; });
+        reindex();
+        invalidateStatus(key);
+        return true;
+    }
+    void commit(char op, const string &payload) { store.commit(op, payload, [this] { save(); }); }
+    void commitBatch(const vector<string> &records) { store.commitBatch(records, [this] { save(); }); }
+public:
+    // loadNow=false leaves the table empty until load() (used to load tables concurrently).
+    PolicyService(const string &file="policies.txt", StorageMode m=StorageMode::Journaled,
+                  FlushPolicy fp=FlushPolicy(), bool loadNow=true)
+        : filename(file), store(file, m, fp) {
+        if (loadNow) load();
+    }
+    ~PolicyService() { flush(); }
+
+    // Entries of c are dropped as policies change (attach after loading).
+    void setStatusCache(PolicyStatusCache *c) { statusCache = c; }
+
+    bool loadSnapshot() {
+        SnapshotReader r(filename, SnapTable::Policies);
+        vector<string_view> pids, types;
+        vector<Money> premiums;
+        vector<int32_t> durations, clientIds, startDays;
+        if (!r.strings(pids) || !r.strings(types) || !r.column(premiums) || !r.column(durations)
+            || !r.column(clientIds) || !r.column(startDays)) return false;
+        vector<Policy> rows(pids.size());
+        parallelRanges(rows.size(), 16384, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                Policy &p = rows[i];
+                p.setPolicyId(pids[i]);
+                p.setType(types[i]);
+                p.setPremium(premiums[i]);
+                p.setDuration(durations[i]);
+                p.setClientId(clientIds[i]);
+                p.setStartDate(Date{startDays[i]});
+            }
+        });
+        cur.rows.reserve(rows.size());
+        rowsOfClient.reserve(rows.size());
+        nextOfClient.reserve(rows.size());
+        for (auto &p : rows) pushRow(p);
+        return true;
+    }
+
+    void saveSnapshot() const {
+        SnapshotWriter w(filename, SnapTable::Policies, cur.rows.size());
+        vector<string_view> pids, types;
+        vector<Money> premiums;
+        vector<int32_t> durations, clientIds, startDays;
+        for (auto &p : cur.rows) {
+            pids.push_back(p.getPolicyId()); types.push_back(p.getType());
+            premiums.push_back(p.getPremium()); durations.push_back(p.getDuration());
+            clientIds.push_back(p.getClientId()); startDays.push_back(p.getStartDate().days);
+        }
+        w.strings(pids);
+        w.strings(types);
+        w.column(premiums); w.column(durations); w.column(clientIds); w.column(startDays);
+        w.commit();
+    }
+
+    void load() {
+        static OpStats &stats = Metrics::get().op("policies.load"); OpTimer t(stats);
+        store.recover();
+        cur = View();
+        byEndDate.clear();
+        rowsOfClient.clear();
+        nextOfClient.clear();
+        lastNum = 1000;
+        if (!loadSnapshot()) {
+            cur = View();
+            byEndDate.clear();
+            rowsOfClient.clear();
+            nextOfClient.clear();
+            lastNum = 1000;
+            if (forEachRecord<Policy>(filename, Policy::fromRecord, [&](Policy &&p) { pushRow(p); }))
+                saveSnapshot();
+        }
+        store.replay(cur.rows.size(), [&](char op, string_view rec) {
+            if (op == '+') upsert(Policy::fromRecord(rec));
+            else if (op == '-') erase(rec);
+        });
+    }
+    
+    // Full rewrite; doubles as the journal checkpoint.
+    void save() {
+        static OpStats &stats = Metrics::get().op("policies.save"); OpTimer t(stats);
+        if (store.checkpoint(cur.rows.size(), [&](ostream &out) {
+                for (auto &p : cur.rows) out << p.toRecord() << "\n";
+            })) saveSnapshot();
+    }
+
+    // Writes pending Deferred changes now / if the flush policy says so.
+    void flush() { store.flush([this] { save(); }); }
+    void tick() { store.tick([this] { save(); }); }
+    bool dueForFlush() const { return store.dueForFlush(); }
+
+    string nextPolicyId() const { return string("P") + to_string(lastNum + 1); }
+    // New ids are handed out past pid from now on (an import reserves the
+    // ids its rows bring before assigning any).
+    void reserveId(string_view pid) { noteId(pid); }
+
+    bool addPolicy(int clientId, const string &type, Money premium, int months, const string &start, string &outPid) {
+        static OpStats &stats = Metrics::get().op("policies.addPolicy"); OpTimer t(stats);
+        Policy p;
+        p.setClientId(clientId);
+        p.setType(type);
+        p.setPremium(premium);
+        p.setDuration(months);
+        Date dt;
+        if (!parseDate(start, dt)) dt = todayApprox();
+        p.setStartDate(dt);
+        p.setPolicyId(nextPolicyId());
+        upsert(p);
+        commit('+', p.toRecord());
+        outPid = string(p.getPolicyId());
+        return true;
+    }
+
+    // Batch form of addPolicy (see ClientService::addClients). Every row needs
+    // an existing client, a type, a positive premium and term and a valid
+    // start date. Rows without a policy id get a new one (written into batch);
+    // rows that bring their own keep it, as long as it is not taken.
+    bool addPolicies(vector<Policy> &batch, const ClientService &clients, string &why, size_t *badRow = nullptr) {
+        static OpStats &stats = Metrics::get().op("policies.addPolicies"); OpTimer t(stats);
+        const ClientService::View &cv = clients.view();
+        unordered_set<uint32_t> given;   // ids brought by earlier rows of the batch
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Policy &p = batch[i];
+            uint32_t key = p.getPolicyKey();
+            const char *bad = key && (cur.findByKey(key) || !given.insert(key).second) ? "policy id already exists"
+                            : key && !fitsRecord(p.getPolicyId()) ? "invalid policy id"
+                            : !cv.findById(p.getClientId()) ? "client not found"
+                            : p.getType().empty() || !fitsRecord(p.getType()) ? "missing or invalid type"
+                            : p.getPremium() <= 0 ? "premium must be positive"
+                            : p.getDuration() <= 0 ? "duration must be positive"
+                            : !p.getStartDate().valid() ? "invalid start date" : nullptr;
+            if (bad) { rejectBatchRow(i, bad, why, badRow); return false; }
+        }
+        vector<string> records;
+        records.reserve(batch.size());
+        cur.rows.reserve(cur.rows.size() + batch.size());
+        for (auto &p : batch) if (p.getPolicyKey()) noteId(p.getPolicyId());   // new ids go past them
+        for (auto &p : batch) {
+            if (!p.getPolicyKey()) p.setPolicyId(nextPolicyId());
+            upsert(p);
+            records.push_back(p.toRecord());
+        }
+        commitBatch(records);
+        return true;
+    }
+
+    const Policy* findByPolicyId(string_view pid) const {
+        static OpStats &stats = Metrics::get().op("policies.findByPolicyId"); OpTimer t(stats);
+        return cur.findByPolicyId(pid);
+    }
+    
+    // In table order, like a scan would return them.
+    vector<const Policy*> findByClientId(int cid) const {
+        static OpStats &stats = Metrics::get().op("policies.findByClientId"); OpTimer t(stats);
+        vector<const Policy*> out;
+        auto it = rowsOfClient.find(cid);
+        if (it == rowsOfClient.end()) return out;
+        for (uint32_t r = it->second.head; r != kNoRow; r = nextOfClient[r]) out.push_back(&cur.rows[r]);
+        return out;
+    }
+
+    bool hasPoliciesFor(int cid) const {
+        static OpStats &stats = Metrics::get().op("policies.hasPoliciesFor"); OpTimer t(stats);
+        return rowsOfClient.count(cid) != 0;
+    }
+
+    bool updatePolicy(const string &pid, const string &type, const string &prem,const string &months, const string &start) {
+        static OpStats &stats = Metrics::get().op("policies.updatePolicy"); OpTimer t(stats);
+        uint32_t row = rowFor(pid);
+        if (row == kNoRow) return false;
+        dropEndIndex(row);
+        Policy *p = &cur.rows.mut(row);
+        invalidateStatus(p->getPolicyKey());
+        if (!type.empty()) p->setType(type);
+        Money m;
+        if (!prem.empty() && parseMoney(prem, m)) p->setPremium(m);
+        if (!months.empty() && isNumber(months)) p->setDuration(stoi(months));
+        if (!start.empty()) {
+            Date dt;
+            if (parseDate(start, dt)) p->setStartDate(dt);
+        }
+        addEndIndex(row);
+        commit('+', p->toRecord());
+        return true;
+    }
+
+    bool removePolicy(const string &pid, bool hasPayments) {
+        static OpStats &stats = Metrics::get().op("policies.removePolicy"); OpTimer t(stats);
+        if (hasPayments) return false;
+        if (!erase(pid)) return false;
+        commit('-', pid);
+        return true;
+    }
+
+    // Business helpers
+    static bool policyEndDate(const Policy &p, Date &endDate) {
+        if (!p.getStartDate().valid()) return false;
+        endDate = addMonths(p.getStartDate(), p.getDuration());
+        return true;
+    }
+
+    // Row numbers behind findByClientId and the end-date index (policies
+    // ending within [from, to]), for a reader that pinned a version under the
+    // same lock (see QueryReport).
+    vector<uint32_t> rowsOfClientId(int cid) const {
+        vector<uint32_t> out;
+        auto it = rowsOfClient.find(cid);
+        if (it == rowsOfClient.end()) return out;
+        for (uint32_t r = it->second.head; r != kNoRow; r = nextOfClient[r]) out.push_back(r);
+        return out;
+    }
+    vector<uint32_t> rowsEndingBetween(Date from, Date to) const {
+        vector<uint32_t> out;
+        auto hi = byEndDate.upper_bound(to);
+        for (auto it = byEndDate.lower_bound(from); it != hi; ++it) out.push_back(it->second);
+        return out;
+    }
+
+    const CowVector<Policy>& getAll() const { return cur.rows; }
+
+    // The current version, pinned: later writes do not show through it.
+    View pin() const { return cur; }
+    const View& view() const { return cur; }
+};
+
+// Running per-policy totals, kept in step with the payment rows, plus the
+// ends of the policy's payment chain (see PaymentService::View::nextRow).
+struct PolicyLedger {
+    Money totalPaid = 0;
+    size_t count = 0;
+    Date lastDate = Date::invalid();   // latest payment date
+    uint32_t head = kNoRow, tail = kNoRow;   // earliest / latest row by date
+};
+
+class PaymentService {
+public:
+    // One published version of the table (see ClientService::View). Stored
+    // column-wise (one vector per field) so bulk aggregation runs over
+    // contiguous chunks; Payment objects are built on demand.
+    struct View {
+        CowVector<uint32_t> policyKeys;     // policyIds() keys
+        CowVector<Money> amounts;
+        CowVector<Date> dates;
+        CowVector<PolicyLedger> ledger;     // indexed by policy key; count==0 means none
+        // Per row, the policy's next payment in (date, row) order, kNoRow at
+        // the end: each policy's history is a chain from ledger head to tail.
+        CowVector<uint32_t> nextRow;
+
+        size_t size() const { return policyKeys.size(); }
+        // fn(row) for the policy's payments, oldest first.
+        template <class Fn>
+        void forEachRowOf(uint32_t key, Fn fn) const {
+            const PolicyLedger *l = ledgerOf(key);
+            for (uint32_t r = l ? l->head : kNoRow; r != kNoRow; r = nextRow[r]) fn(r);
+        }
+        Payment at(size_t i) const { return Payment(policyKeys[i], amounts[i], dates[i]); }
+        const PolicyLedger* ledgerOf(uint32_t key) const {
+            return key < ledger.size() && ledger[key].count ? &ledger[key] : nullptr;
+        }
+        Money totalPaid(uint32_t key) const {
+            const PolicyLedger *l = ledgerOf(key);
+            return l ? l->totalPaid : 0;
+        }
+        // Every payment ever received, summed chunk by chunk over the amount column.
+        Money totalReceived() const {
+            Money s = 0;
+            amounts.forEachChunk([&](const Money *v, size_t n) { s += sumMoney(v, n); });
+            return s;
+        }
+    };
+private:
+    View cur;
+    string filename;
+    TableStore store;
+    PolicyStatusCache *statusCache = nullptr;
+
+    PolicyLedger& addToLedger(uint32_t key, Money amount, Date dt) {
+        if (statusCache) statusCache->invalidate(key);
+        if (key >= cur.ledger.size()) cur.ledger.resize(max<size_t>(key + 1, cur.ledger.size() * 2));
+        PolicyLedger &l = cur.ledger.mut(key);
+        l.totalPaid += amount;
+        ++l.count;
+        if (l.lastDate < dt) l.lastDate = dt;
+        return l;
+    }
+    // Puts row into its policy's chain after every payment dated on or before
+    // it. Payments mostly arrive in date order, so this is usually the tail.
+    void link(PolicyLedger &l, uint32_t row) {
+        Date dt = cur.dates[row];
+        if (l.tail == kNoRow) { l.head = l.tail = row; return; }
+        if (!(dt < cur.dates[l.tail])) { cur.nextRow.mut(l.tail) = row; l.tail = row; return; }
+        if (dt < cur.dates[l.head]) { cur.nextRow.mut(row) = l.head; l.head = row; return; }
+        uint32_t at = l.head;
+        while (!(dt < cur.dates[cur.nextRow[at]])) at = cur.nextRow[at];
+        cur.nextRow.mut(row) = cur.nextRow[at];
+        cur.nextRow.mut(at) = row;
+    }
+    // linked=false leaves the chains to a relink() once the batch is in.
+    void append(uint32_t key, Money amount, Date dt, bool linked = true) {
+        uint32_t row = (uint32_t)cur.size();
+        cur.policyKeys.push_back(key);
+        cur.amounts.push_back(amount);
+        cur.dates.push_back(dt);
+        cur.nextRow.push_back(kNoRow);
+        PolicyLedger &l = addToLedger(key, amount, dt);
+        if (linked) link(l, row);
+    }
+    void append(const Payment &pm, bool linked = true) {
+        append(pm.getPolicyKey(), pm.getAmount(), pm.getDate(), linked);
+    }
+    // Rebuilds every chain: rows grouped by policy (counting sort, so row
+    // order holds within a group), each group sorted by date, then threaded.
+    void relink() {
+        size_t n = cur.size(), keys = cur.ledger.size();
+        vector<uint32_t> start(keys + 1, 0);
+        for (size_t r = 0; r < n; ++r) ++start[cur.policyKeys[r] + 1];
+        for (size_t k = 0; k < keys; ++k) start[k + 1] += start[k];
+        vector<uint32_t> order(n), fill(start.begin(), start.end() - 1);
+        for (size_t r = 0; r < n; ++r) order[fill[cur.policyKeys[r]]++] = (uint32_t)r;
+        parallelRanges(keys, 4096, [&](size_t b, size_t e) {
+            for (size_t k = b; k < e; ++k)
+                stable_sort(order.begin() + start[k], order.begin() + start[k + 1], [&](uint32_t x, uint32_t y) {
+                    return cmpDate(cur.dates[x], cur.dates[y]) < 0;
+                });
+        });
+        CowVector<uint32_t> next;
+        next.resize(n, kNoRow);
+        for (size_t k = 0; k < keys; ++k) {
+            uint32_t b = start[k], e = start[k + 1];
+            if (b == e) continue;
+            for (uint32_t i = b; i + 1 < e; ++i) next.mut(order[i]) = order[i + 1];
+            PolicyLedger &l = cur.ledger.mut(k);
+            l.head = order[b];
+            l.tail = order[e - 1];
+        }
+        cur.nextRow = move(next);
+    }
+    // Threads rows [from, size) appended unlinked into their policies'
+    // chains. The new rows are grouped by policy in date order, and each
+    // group is merged into its existing chain in one walk (a plain append
+    // when it starts on or after the tail), so a batch costs O(k log k) plus
+    // the chains it actually lands inside.
+    void linkFrom(uint32_t from) {
+        vector<uint32_t> fresh(cur.size() - from);
+        for (size_t i = 0; i < fresh.size(); ++i) fresh[i] = from + (uint32_t)i;
+        stable_sort(fresh.begin(), fresh.end(), [&](uint32_t x, uint32_t y) {
+            if (cur.policyKeys[x] != cur.policyKeys[y]) return cur.policyKeys[x] < cur.policyKeys[y];
+            return cmpDate(cur.dates[x], cur.dates[y]) < 0;
+        });
+        vector<uint32_t> merged;
+        for (size_t b = 0, e; b < fresh.size(); b = e) {
+            uint32_t key = cur.policyKeys[fresh[b]];
+            for (e = b + 1; e < fresh.size() && cur.policyKeys[fresh[e]] == key; ++e) {}
+            PolicyLedger &l = cur.ledger.mut(key);
+            merged.clear();
+            if (l.tail != kNoRow && cur.dates[fresh[b]] < cur.dates[l.tail]) {
+                // Old rows come first on equal dates: they are lower rows.
+                uint32_t r = l.head;
+                for (size_t i = b; i < e; ++i) {
+                    while (r != kNoRow && !(cur.dates[fresh[i]] < cur.dates[r])) { merged.push_back(r); r = cur.nextRow[r]; }
+                    merged.push_back(fresh[i]);
+                }
+                for (; r != kNoRow; r = cur.nextRow[r]) merged.push_back(r);
+                l.head = merged.front();
+            } else {
+                if (l.tail != kNoRow) merged.push_back(l.tail);
+                else l.head = fresh[b];
+                merged.insert(merged.end(), fresh.begin() + b, fresh.begin() + e);
+            }
+            for (size_t i = 0; i + 1 < merged.size(); ++i) cur.nextRow.mut(merged[i]) = merged[i + 1];
+            cur.nextRow.mut(merged.back()) = kNoRow;
+            l.tail = merged.back();
+        }
+    }
+    bool erase(string_view pid) {
+        uint32_t key;
+        if (!policyIds().find(pid, key) || !cur.ledgerOf(key)) return false;
+        if (statusCache) statusCache->invalidate(key);
+        cur.ledger.mut(key) = PolicyLedger();
+        View next;
+        next.ledger = cur.ledger;
+        for (size_t r = 0; r < cur.size(); ++r) {
+            if (cur.policyKeys[r] == key) continue;
+            next.policyKeys.push_back(cur.policyKeys[r]);
+            next.amounts.push_back(cur.amounts[r]);
+            next.dates.push_back(cur.dates[r]);
+        }
+        cur = move(next);
+        relink();   // rows moved
+        return true;
+    }
+    void commit(char op, const string &payload) { store.commit(op, payload, [this] { save(); }); }
+    void commitBatch(const vector<string> &records) { store.commitBatch(records, [this] { save(); }); }
+public:
+    // loadNow=false leaves the table empty until load() (used to load tables concurrently).
+    PaymentService(const string &file="payments.txt", StorageMode m=StorageMode::Journaled,
+                   FlushPolicy fp=FlushPolicy(), bool loadNow=true)
+        : filename(file), store(file, m, fp) {
+        if (loadNow) load();
+    }
+    ~PaymentService() { flush(); }
+
+    // Entries of c are dropped as payments change (attach after loading).
+    void setStatusCache(PolicyStatusCache *c) { statusCache = c; }
+
+    bool loadSnapshot() {
+        SnapshotReader r(filename, SnapTable::Payments);
+        vector<string_view> pids;
+        vector<Money> amounts;
+        vector<Date> dates;
+        if (!r.strings(pids) || !r.column(amounts) || !r.column(dates)) return false;
+        vector<uint32_t> keys(pids.size());
+        parallelRanges(pids.size(), 65536, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) keys[i] = policyIds().intern(pids[i]);
+        });
+        cur.policyKeys.reserve(keys.size()); cur.amounts.reserve(keys.size()); cur.dates.reserve(keys.size());
+        cur.nextRow.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) append(keys[i], amounts[i], dates[i], false);
+        return true;
+    }
+
+    void saveSnapshot() const {
+        SnapshotWriter w(filename, SnapTable::Payments, cur.size());
+        vector<string_view> pids;
+        pids.reserve(cur.size());
+        for (uint32_t k : cur.policyKeys) pids.push_back(policyIds().str(k));
+        w.strings(pids);
+        w.column(cur.amounts);
+        w.column(cur.dates);
+        w.commit();
+    }
+
+    void load() {
+        static OpStats &stats = Metrics::get().op("payments.load"); OpTimer t(stats);
+        store.recover();
+        cur = View();
+        if (!loadSnapshot()) {
+            cur = View();
+            if (forEachRecord<Payment>(filename, Payment::fromRecord, [&](Payment &&pm) {
+                    append(pm, false);
+                })) saveSnapshot();
+        }
+        // Journaled rows go in unlinked too (backdated ones would each walk
+        // their chain); one relink threads everything.
+        store.replay(cur.size(), [&](char op, string_view rec) {
+            if (op == '+') append(Payment::fromRecord(rec), false);
+            else if (op == '-') erase(rec);
+        });
+        relink();
+    }
+    
+    // Full rewrite; doubles as the journal checkpoint.
+    void save() {
+        static OpStats &stats = Metrics::get().op("payments.save"); OpTimer t(stats);
+        if (store.checkpoint(cur.size(), [&](ostream &out) {
+                for (size_t i = 0; i < size(); ++i) out << at(i).toRecord() << "\n";
+            })) saveSnapshot();
+    }
+
+    // Writes pending Deferred changes now / if the flush policy says so.
+    void flush() { store.flush([this] { save(); }); }
+    void tick() { store.tick([this] { save(); }); }
+    bool dueForFlush() const { return store.dueForFlush(); }
+
+    void recordPayment(string_view pid, Money amount, const string &dateStr) {
+        static OpStats &stats = Metrics::get().op("payments.recordPayment"); OpTimer t(stats);
+        Date dt;
+        if (!parseDate(dateStr, dt)) dt = todayApprox();
+        Payment pm(pid, amount, dt);
+        append(pm);
+        commit('+', pm.toRecord());
+    }
+
+    // Batch form of recordPayment (see ClientService::addClients). Every row
+    // needs an existing policy and a valid date.
+    bool recordPayments(const vector<Payment> &batch, const PolicyService &policies, string &why,
+                        size_t *badRow = nullptr) {
+        static OpStats &stats = Metrics::get().op("payments.recordPayments"); OpTimer t(stats);
+        const PolicyService::View &pv = policies.view();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const char *bad = !pv.findByKey(batch[i].getPolicyKey()) ? "policy not found"
+                            : !batch[i].getDate().valid() ? "invalid date" : nullptr;
+            if (bad) { rejectBatchRow(i, bad, why, badRow); return false; }
+        }
+        vector<string> records;
+        records.reserve(batch.size());
+        uint32_t from = (uint32_t)cur.size();
+        for (auto &pm : batch) {
+            append(pm, false);
+            records.push_back(pm.toRecord());
+        }
+        linkFrom(from);
+        commitBatch(records);
+        return true;
+    }
+
+    // Oldest first (ties in recording order), straight off the policy's chain.
+    vector<Payment> findByPolicyId(string_view pid) const {
+        static OpStats &stats = Metrics::get().op("payments.findByPolicyId"); OpTimer t(stats);
+        vector<Payment> out;
+        uint32_t key;
+        const PolicyLedger *l = policyIds().find(pid, key) ? cur.ledgerOf(key) : nullptr;
+        if (!l) return out;
+        out.reserve(l->count);
+        cur.forEachRowOf(key, [&](uint32_t r) { out.push_back(cur.at(r)); });
+        return out;
+    }
+
+    const PolicyLedger* ledgerOf(uint32_t key) const { return cur.ledgerOf(key); }
+    const PolicyLedger* ledgerOf(string_view pid) const {
+        uint32_t key;
+        return policyIds().find(pid, key) ? ledgerOf(key) : nullptr;
+    }
+
+    // Key-based form for callers that already hold a Policy (no hashing).
+    Money totalPaid(uint32_t key) const { return cur.totalPaid(key); }
+    Money totalPaid(string_view pid) const {
+        static OpStats &stats = Metrics::get().op("payments.totalPaid"); OpTimer t(stats);
+        const PolicyLedger *l = ledgerOf(pid);
+        return l ? l->totalPaid : 0;
+    }
+
+    bool hasPayments(string_view pid) const {
+        static OpStats &stats = Metrics::get().op("payments.hasPayments"); OpTimer t(stats);
+        return ledgerOf(pid) != nullptr;
+    }
+
+    void deletePaymentsOf(string_view pid) {
+        static OpStats &stats = Metrics::get().op("payments.deletePaymentsOf"); OpTimer t(stats);
+        if (erase(pid)) commit('-', string(pid));
+    }
+
+    size_t size() const { return cur.size(); }
+    Payment at(size_t i) const { return cur.at(i); }
+    Money totalReceived() const { return cur.totalReceived(); }
+
+    // The current version, pinned: later writes do not show through it.
+    View pin() const { return cur; }
+    const View& view() const { return cur; }
+};
+
+// Business login for my reference
+// Installments (due at start + k months, k = 1..duration) falling on or
+// before `by`. Payments settle installments oldest first, so what is still
+// owed on them is max(0, count * premium - paid).
+static int installmentsDueBy(const Policy &p, Date by) {
+    Date st = p.getStartDate();
+    if (!st.valid() || by < st) return 0;
+    CivilDate a = toCivil(st), b = toCivil(by);
+    int k = (b.y - a.y) * 12 + (b.m - a.m);
+    if (k > p.getDuration()) return p.getDuration();
+    if (k > 0 && by < addMonths(st, k)) --k;
+    return max(0, k);
+}
+
+//Report output: reports emit typed cells into a RowSink, which lays them out
+// (fixed-width table, CSV or JSON Lines) in one reusable buffer and hands it
+// to the FILE* in large writes. Numbers go through to_chars, not iostreams.
+enum class SinkFormat { Table, Csv, Jsonl };
+
+struct ReportColumn {
+    const char *name;
+    int width;   // table padding; 0 = unpadded
+};
+
+class RowSink {
+    static const size_t kFlushAt = 1 << 16;
+    FILE *file;   // nullptr discards the output (formatting still runs)
+    bool owned;
+    string buf;
+protected:
+    vector<ReportColumn> cols;
+    size_t col = 0;
+
+    void put(string_view s) { buf.append(s.data(), s.size()); }
+    void put(char c) { buf.push_back(c); }
+    size_t pending() const { return buf.size(); }
+    void padFrom(size_t start, int width) {
+        size_t used = buf.size() - start;
+        if (width > 0 && used < (size_t)width) buf.append((size_t)width - used, ' ');
+    }
+
+    virtual void field(string_view text, bool isText) = 0;   // isText: false for numbers
+    virtual void rowEnd() = 0;
+public:
+    explicit RowSink(FILE *f = stdout) : file(f), owned(false) { buf.reserve(kFlushAt + 4096); }
+    explicit RowSink(const string &path) : file(fopen(path.c_str(), "wb")), owned(true) {
+        buf.reserve(kFlushAt + 4096);
+    }
+    virtual ~RowSink() {
+        flush();
+        if (owned && file) fclose(file);
+    }
+    RowSink(const RowSink&) = delete;
+    RowSink& operator=(const RowSink&) = delete;
+
+    bool isOpen() const { return !owned || file; }
+
+    void begin(initializer_list<ReportColumn> c) { begin(vector<ReportColumn>(c)); }
+    // Column set chosen at run time (ad-hoc queries).
+    virtual void begin(vector<ReportColumn> c) { cols = move(c); col = 0; }
+    // Free-text line (window, trailer totals); only the table layout shows it.
+    virtual void note(string_view) {}
+
+    void cell(string_view s) { field(s, true); ++col; }
+    void cell(const char *s) { cell(string_view(s)); }
+    void cell(long long v) {
+        char b[24];
+        field(string_view(b, (size_t)(to_chars(b, b + sizeof(b), v).ptr - b)), false);
+        ++col;
+    }
+    void cell(int v) { cell((long long)v); }
+    void cell(size_t v) { cell((long long)v); }
+    void cellMoney(Money m) { char b[32]; field(string_view(b, moneyToChars(b, m)), false); ++col; }
+    void cellDate(Date d) { char b[16]; field(string_view(b, dateToChars(b, d)), true); ++col; }
+    void endRow() {
+        rowEnd();
+        col = 0;
+        if (buf.size() >= kFlushAt) flush();
+    }
+
+    void flush() {
+        if (file && !buf.empty()) {
+            fwrite(buf.data(), 1, buf.size(), file);
+            fflush(file);
+            Metrics::get().bytesWritten(owned ? "report" : file == stdout ? "stdout" : "stream", buf.size());
+        }
+        buf.clear();
+    }
+};
+
+// The layout the reports always printed: left-aligned, space padded.
+class TableSink : public RowSink {
+protected:
+    void field(string_view text, bool) override {
+        size_t start = pending();
+        put(text);
+        padFrom(start, col < cols.size() ? cols[col].width : 0);
+    }
+    void rowEnd() override { put('\n'); }
+public:
+    using RowSink::RowSink;
+    using RowSink::begin;
+    void begin(vector<ReportColumn> c) override {
+        RowSink::begin(move(c));
+        for (auto &rc : cols) cell(rc.name);
+        endRow();
+    }
+    void note(string_view line) override { put(line); put('\n'); }
+};
+
+// RFC 4180: header row, fields quoted only when they need it.
+class CsvSink : public RowSink {
+protected:
+    void field(string_view text, bool isText) override {
+        if (col) put(',');
+        if (!isText || text.find_first_of(",\"\r\n") == string_view::npos) { put(text); return; }
+        put('"');
+        for (char ch : text) { if (ch == '"') put('"'); put(ch); }
+        put('"');
+    }
+    void rowEnd() override { put('\n'); }
+public:
+    using RowSink::RowSink;
+    using RowSink::begin;
+    void begin(vector<ReportColumn> c) override {
+        RowSink::begin(move(c));
+        for (auto &rc : cols) cell(rc.name);
+        endRow();
+    }
+};
+
+// One JSON object per row, keyed by column name; money stays a decimal number.
+class JsonlSink : public RowSink {
+    void quoted(string_view s) { jsonQuoted(s, [this](string_view p) { put(p); }); }
+protected:
+    void field(string_view text, bool isText) override {
+        put(col ? ',' : '{');
+        quoted(col < cols.size() ? cols[col].name : "");
+        put(':');
+        if (isText) quoted(text); else put(text);
+    }
+    void rowEnd() override { put(col ? "}\n" : "{}\n"); }
+public:
+    using RowSink::RowSink;
+};
+
+static bool parseSinkFormat(string_view s, SinkFormat &f) {
+    if (s == "table" || s == "text") f = SinkFormat::Table;
+    else if (s == "csv") f = SinkFormat::Csv;
+    else if (s == "jsonl" || s == "json") f = SinkFormat::Jsonl;
+    else return false;
+    return true;
+}
+
+// Writes to an already open stream (not closed by the sink).
+static unique_ptr<RowSink> makeSink(SinkFormat f, FILE *stream) {
+    switch (f) {
+        case SinkFormat::Csv:   return make_unique<CsvSink>(stream);
+        case SinkFormat::Jsonl: return make_unique<JsonlSink>(stream);
+        default:                return make_unique<TableSink>(stream);
+    }
+}
+
+// Empty path = stdout.
+static unique_ptr<RowSink> makeSink(SinkFormat f, const string &path = "") {
+    switch (f) {
+        case SinkFormat::Csv:   return path.empty() ? make_unique<CsvSink>() : make_unique<CsvSink>(path);
+        case SinkFormat::Jsonl: return path.empty() ? make_unique<JsonlSink>() : make_unique<JsonlSink>(path);
+        default:                return path.empty() ? make_unique<TableSink>() : make_unique<TableSink>(path);
+    }
+}
+
+
+//Reports Step 4 ,polymorphism
+// Reports pin a version of the tables they read when constructed, so their
+// output is one point in time however long generate() takes, and writers are
+// never held up by it.
+
+// Window for the month-based reports (3 and 7); the cash-flow arrays scale
+// with it, so every entry point refuses anything longer.
+static const int kMaxReportMonths = 1200;
+static bool validReportMonths(int n) { return n >= 0 && n <= kMaxReportMonths; }
+class Report {
+public:
+    virtual ~Report() {}
+    virtual void generate(RowSink &out) = 0;  // polymorphic interface
+    void generate() { TableSink out; generate(out); }
+};
+
+class AllClientsReport : public Report {
+    ClientService::View cs;
+public:
+    AllClientsReport(const ClientService &c) : cs(c.pin()) {}
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.AllClients"); OpTimer t(stats);
+        out.begin({{"ID", 8}, {"Name", 22}, {"Age", 6}, {"Contact", 15}, {"Address", 0}});
+        for (auto &c : cs.rows) {
+            out.cell(c.getId()); out.cell(c.getName()); out.cell(c.getAge());
+            out.cell(c.getContact()); out.cell(c.getAddress());
+            out.endRow();
+        }
+    }
+};
+
+class AllPoliciesReport : public Report {
+    PolicyService::View ps;
+public:
+    AllPoliciesReport(const PolicyService &p) : ps(p.pin()) {}
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.AllPolicies"); OpTimer t(stats);
+        out.begin({{"PolicyID", 10}, {"Client", 8}, {"Type", 12}, {"Premium", 12}, {"Months", 10}, {"Start", 12}});
+        for (auto &p : ps.rows) {
+            out.cell(p.getPolicyId()); out.cell(p.getClientId()); out.cell(p.getType());
+            out.cellMoney(p.getPremium()); out.cell(p.getDuration()); out.cellDate(p.getStartDate());
+            out.endRow();
+        }
+    }
+};
+
+// The window is fixed when the report is made: its rows come off the live
+// end-date index then, under the caller's lock, as QueryReport does.
+class ExpiringPoliciesReport : public Report {
+    PolicyService::View ps;
+    ClientService::View cs;
+    Date now, endWindow;
+    vector<uint32_t> rows;
+public:
+    ExpiringPoliciesReport(const PolicyService &p, const ClientService &c, int n)
+        : ps(p.pin()), cs(c.pin()), now(todayApprox()), endWindow(addMonths(now, n)),
+          rows(p.rowsEndingBetween(now, endWindow)) {}
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.ExpiringPolicies"); OpTimer t(stats);
+        out.note("Window End: " + dateToString(endWindow));
+        out.begin({{"PolicyID", 10}, {"Client", 8}, {"ClientName", 22}, {"EndDate", 12}});
+        // The index's rows are split into parallel partitions (end date +
+        // client join per row) and come back in index order; the index keeps
+        // equal end dates in update order, so the sort puts ties by row.
+        struct Hit { Date end; uint32_t row; string_view cname; };
+        vector<Hit> hits = gatherPartitions<Hit>(rows.size(), CowVector<Policy>::kChunk,
+            [&](size_t b, size_t e, vector<Hit> &part) {
+                for (size_t i = b; i < e; ++i) {
+                    const Policy &p = ps.rows[rows[i]];
+                    Date ed;
+                    if (!PolicyService::policyEndDate(p, ed)) continue;
+                    const Client *cptr = cs.findById(p.getClientId());
+                    part.push_back(Hit{ed, rows[i], cptr ? cptr->getName() : "[Unknown]"});
+                }
+            });
+        sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+            return a.end != b.end ? a.end < b.end : a.row < b.row;
+        });
+        for (auto &h : hits) {
+            const Policy &p = ps.rows[h.row];
+            out.cell(p.getPolicyId()); out.cell(p.getClientId()); out.cell(h.cname); out.cellDate(h.end);
+            out.endRow();
+        }
+    }
+};
+
+class UnpaidClientsReport : public Report {
+    PolicyService::View ps;
+    ClientService::View cs;
+    PaymentService::View pay;
+public:
+    UnpaidClientsReport(const PolicyService &p, const ClientService &c, const PaymentService &pm)
+        : ps(p.pin()), cs(c.pin()), pay(pm.pin()) {}
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.UnpaidClients"); OpTimer t(stats);
+        out.begin({{"Client", 8}, {"Name", 22}, {"PolicyID", 12}, {"Remaining", 12}});
+        // Balances and client joins run in parallel partitions; rows come
+        // back in policy order, so output matches a serial pass.
+        struct Row { const Policy *p; string_view cname; Money rem; };
+        vector<Row> rows = gatherPartitions<Row>(ps.rows.size(), CowVector<Policy>::kChunk,
+            [&](size_t b, size_t e, vector<Row> &part) {
+                for (size_t i = b; i < e; ++i) {
+                    const Policy &p = ps.rows[i];
+                    Money rem = PolicyStatusCache::remaining(p, pay.totalPaid(p.getPolicyKey()));
+                    if (rem <= 0) continue;
+                    const Client *cptr = cs.findById(p.getClientId());
+                    part.push_back(Row{&p, cptr ? cptr->getName() : "[Unknown]", rem});
+                }
+            });
+        for (auto &r : rows) {
+            out.cell(r.p->getClientId()); out.cell(r.cname); out.cell(r.p->getPolicyId()); out.cellMoney(r.rem);
+            out.endRow();
+        }
+    }
+};
+
+class PortfolioTotalsReport : public Report {
+    PolicyService::View ps;
+    PaymentService::View pay;
+public:
+    PortfolioTotalsReport(const PolicyService &p, const PaymentService &pm) : ps(p.pin()), pay(pm.pin()) {}
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.PortfolioTotals"); OpTimer t(stats);
+        // Lay out due/paid columns grouped by policy type (counting sort), so
+        // every total below is one contiguous reduction.
+        // Types are interned, so the buckets are indexed by type key.
+        vector<size_t> typeCount;
+        for (auto &p : ps.rows) {
+            uint32_t k = p.getTypeKey();
+            if (k >= typeCount.size()) typeCount.resize(k + 1, 0);
+            ++typeCount[k];
+        }
+        map<string_view, uint32_t> byName;   // print order
+        for (uint32_t k = 0; k < typeCount.size(); ++k)
+            if (typeCount[k]) byName.emplace(policyTypes().str(k), k);
+        vector<size_t> typeStart(typeCount.size(), 0);
+        size_t off = 0;
+        for (auto &bn : byName) { typeStart[bn.second] = off; off += typeCount[bn.second]; }
+
+        vector<Money> due(off), paid(off);
+        vector<size_t> fill = typeStart;
+        for (auto &p : ps.rows) {
+            size_t i = fill[p.getTypeKey()]++;
+            due[i] = p.getPremium() * p.getDuration();
+            paid[i] = pay.totalPaid(p.getPolicyKey());
+        }
+
+        out.begin({{"Type", 14}, {"Policies", 10}, {"Due", 16}, {"Paid", 16}, {"Outstanding", 0}});
+        auto row = [&](string_view name, size_t b, size_t n) {
+            out.cell(name); out.cell(n);
+            out.cellMoney(sumMoney(due.data() + b, n));
+            out.cellMoney(sumMoney(paid.data() + b, n));
+            out.cellMoney(sumShortfall(due.data() + b, paid.data() + b, n));
+            out.endRow();
+        };
+        for (auto &bn : byName) row(bn.first, typeStart[bn.second], typeCount[bn.second]);
+        row("ALL", 0, off);
+        out.note("Total Received (all payments): " + moneyToString(pay.totalReceived()));
+    }
+};
+
+// Outstanding premium by days overdue, per policy type. The oldest unpaid
+// installment is the one PolicyStatus::nextDue reports; instead of walking each
+// policy's installments, the amount owed on everything due by each bucket
+// edge comes from installmentsDueBy() and the ledger total, so every policy
+// costs O(1) and the book is one pass (partitioned across the pool).
+class ReceivablesAgingReport : public Report {
+    PolicyService::View ps;
+    PaymentService::View pay;
+public:
+    static const int kBuckets = 5;   // current, 1-30, 31-60, 61-90, 90+
+    struct Totals {
+        size_t policies = 0;         // with anything outstanding
+        Money bucket[kBuckets] = {};
+    };
+
+    ReceivablesAgingReport(const PolicyService &p, const PaymentService &pm) : ps(p.pin()), pay(pm.pin()) {}
+
+    // "Current" is the next installment when it is not yet overdue.
+    static bool age(const Policy &p, Money paid, Date today, Money (&b)[kBuckets]) {
+        Money prem = p.getPremium();
+        if (prem <= 0 || !p.getStartDate().valid()) return false;
+        auto owed = [&](int n) { return max<Money>(0, n * prem - paid); };
+        int due0  = installmentsDueBy(p, Date{today.days - 1});
+        int due30 = installmentsDueBy(p, Date{today.days - 31});
+        int due60 = installmentsDueBy(p, Date{today.days - 61});
+        int due90 = installmentsDueBy(p, Date{today.days - 91});
+        b[0] = owed(min(due0 + 1, p.getDuration())) - owed(due0);
+        b[1] = owed(due0) - owed(due30);
+        b[2] = owed(due30) - owed(due60);
+        b[3] = owed(due60) - owed(due90);
+        b[4] = owed(due90);
+        return b[0] || b[1] || b[2] || b[3] || b[4];
+    }
+
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.ReceivablesAging"); OpTimer t(stats);
+        Date today = todayApprox();
+        // One accumulator per partition (indexed by type key), summed afterwards.
+        vector<vector<Totals>> parts = gatherPartitions<vector<Totals>>(ps.rows.size(), CowVector<Policy>::kChunk,
+            [&](size_t b, size_t e, vector<vector<Totals>> &part) {
+                vector<Totals> acc;
+                for (size_t i = b; i < e; ++i) {
+                    const Policy &p = ps.rows[i];
+                    Money amt[kBuckets];
+                    if (!age(p, pay.totalPaid(p.getPolicyKey()), today, amt)) continue;
+                    uint32_t k = p.getTypeKey();
+                    if (k >= acc.size()) acc.resize(k + 1);
+                    ++acc[k].policies;
+                    for (int j = 0; j < kBuckets; ++j) acc[k].bucket[j] += amt[j];
+                }
+                part.push_back(move(acc));
+            });
+        vector<Totals> byType;
+        Totals all;
+        for (auto &acc : parts) {
+            if (acc.size() > byType.size()) byType.resize(acc.size());
+            for (size_t k = 0; k < acc.size(); ++k) {
+                byType[k].policies += acc[k].policies;
+                all.policies += acc[k].policies;
+                for (int j = 0; j < kBuckets; ++j) {
+                    byType[k].bucket[j] += acc[k].bucket[j];
+                    all.bucket[j] += acc[k].bucket[j];
+                }
+            }
+        }
+        map<string_view, uint32_t> byName;   // print order
+        for (uint32_t k = 0; k < byType.size(); ++k)
+            if (byType[k].policies) byName.emplace(policyTypes().str(k), k);
+
+        out.note("As of: " + dateToString(today));
+        out.begin({{"Type", 14}, {"Policies", 10}, {"Current", 14}, {"1-30", 14}, {"31-60", 14},
+                   {"61-90", 14}, {"90+", 14}, {"Total", 0}});
+        auto row = [&](string_view name, const Totals &tt) {
+            Money total = 0;
+            out.cell(name); out.cell(tt.policies);
+            for (int j = 0; j < kBuckets; ++j) { out.cellMoney(tt.bucket[j]); total += tt.bucket[j]; }
+            out.cellMoney(total);
+            out.endRow();
+        };
+        for (auto &bn : byName) row(bn.first, byType[bn.second]);
+        row("ALL", all);
+    }
+};
+
+// Month-by-month premium expected (installment k of every policy falls in
+// month start + k) against payments received, per policy type. A policy adds
+// its premium to a run of months, so each one is two writes into a
+// difference array (+premium where the run starts, -premium after it ends)
+// and a prefix sum over the window recovers the totals; payments are a plain
+// per-month histogram. Both passes run in pool partitions, each with its own
+// arrays, summed afterwards.
+class CashFlowProjectionReport : public Report {
+    PolicyService::View ps;
+    PaymentService::View pay;
+    int first;    // window start, as a month number (see monthNumber)
+    int months;
+public:
+    // Months since year 0; addMonths(d, k) always lands in monthNumber(d) + k.
+    static int monthNumber(Date d) { CivilDate c = toCivil(d); return c.y * 12 + (c.m - 1); }
+
+    // from = any day of the first month; invalid = this month.
+    CashFlowProjectionReport(const PolicyService &p, const PaymentService &pm, int n, Date from = Date::invalid())
+        : ps(p.pin()), pay(pm.pin()), first(monthNumber(from.valid() ? from : todayApprox())),
+          months(min(max(1, n), kMaxReportMonths)) {}
+
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.CashFlowProjection"); OpTimer t(stats);
+        // Arrays are indexed by a dense slot per type the pinned policies use
+        // (the interner also holds types no policy has any more).
+        vector<uint32_t> slotOf;       // type key -> slot
+        vector<uint32_t> typeOfSlot;   // slot -> type key
+        for (auto &p : ps.rows) {
+            uint32_t k = p.getTypeKey();
+            if (k >= slotOf.size()) slotOf.resize(k + 1, kNoRow);
+            if (slotOf[k] == kNoRow) { slotOf[k] = (uint32_t)typeOfSlot.size(); typeOfSlot.push_back(k); }
+        }
+        const size_t nTypes = typeOfSlot.size() + 1;     // last slot: payments of unknown policies
+        const size_t unknown = nTypes - 1;
+        const size_t span = (size_t)months + 1;           // one spare month for run ends
+        const int last = first + months;                  // exclusive
+
+        // Expected: slot [type * span + month] of each worker's difference array.
+        auto zeroed = [&] { return vector<Money>(nTypes * span, 0); };
+        vector<vector<Money>> dueParts = reducePartitions<vector<Money>>(ps.rows.size(), CowVector<Policy>::kChunk, zeroed,
+            [&](size_t b, size_t e, vector<Money> &diff) {
+                for (size_t i = b; i < e; ++i) {
+                    const Policy &p = ps.rows[i];
+                    if (!p.getStartDate().valid() || p.getDuration() <= 0 || !p.getPremium()) continue;
+                    int s = monthNumber(p.getStartDate());
+                    int lo = max(s + 1, first), hi = min(s + p.getDuration() + 1, last);
+                    if (lo >= hi) continue;
+                    Money *d = diff.data() + slotOf[p.getTypeKey()] * span;
+                    d[lo - first] += p.getPremium();
+                    d[hi - first] -= p.getPremium();
+                }
+            });
+        vector<vector<Money>> paidParts = reducePartitions<vector<Money>>(pay.size(), CowVector<Money>::kChunk, zeroed,
+            [&](size_t b, size_t e, vector<Money> &hist) {
+                for (size_t i = b; i < e; ++i) {
+                    Date d = pay.dates[i];
+                    if (!d.valid()) continue;
+                    int m = monthNumber(d);
+                    if (m < first || m >= last) continue;
+                    const Policy *p = ps.findByKey(pay.policyKeys[i]);
+                    hist[(p ? slotOf[p->getTypeKey()] : unknown) * span + (m - first)] += pay.amounts[i];
+                }
+            });
+
+        vector<Money> due(nTypes * span, 0), paid(nTypes * span, 0);
+        for (auto &d : dueParts) for (size_t j = 0; j < d.size(); ++j) due[j] += d[j];
+        for (auto &h : paidParts) for (size_t j = 0; j < h.size(); ++j) paid[j] += h[j];
+        vector<bool> used(nTypes, false);
+        for (size_t k = 0; k < nTypes; ++k) {
+            Money run = 0;
+            for (size_t m = 0; m < (size_t)months; ++m) {
+                due[k * span + m] = run += due[k * span + m];
+                if (due[k * span + m] || paid[k * span + m]) used[k] = true;
+            }
+        }
+        map<string_view, uint32_t> byName;   // print order
+        for (uint32_t k = 0; k < unknown; ++k) if (used[k]) byName.emplace(policyTypes().str(typeOfSlot[k]), k);
+
+        out.note("Window: " + dateToString(fromCivil(first / 12, first % 12 + 1, 1)) + " + " + to_string(months) + " months");
+        out.begin({{"Month", 9}, {"Type", 14}, {"Expected", 16}, {"Received", 16}, {"Difference", 0}});
+        auto row = [&](int m, string_view name, Money exp, Money got) {
+            char ym[16];
+            snprintf(ym, sizeof(ym), "%04d-%02d", m / 12, m % 12 + 1);
+            out.cell(ym); out.cell(name);
+            out.cellMoney(exp); out.cellMoney(got); out.cellMoney(got - exp);
+            out.endRow();
+        };
+        for (int m = 0; m < months; ++m) {
+            Money expAll = 0, gotAll = 0;
+            for (auto &bn : byName) {
+                Money exp = due[bn.second * span + m], got = paid[bn.second * span + m];
+                row(first + m, bn.first, exp, got);
+                expAll += exp; gotAll += got;
+            }
+            gotAll += paid[unknown * span + m];
+            row(first + m, "ALL", expAll, gotAll);
+        }
+    }
+};
+
+
+//Ad-hoc queries: one generic report driven by a small query language, e.g.
+//   policies type=Health and premium>500 and start>=2024-01-01 select id,premium sort premium desc limit 20
+//   payments policy=P1042 and date>=2024-01-01
+// Conditions are ANDed. Each one compiles to an inclusive range on a single
+// integer column (money in cents, dates in days, ids and types as interned
+// keys), and conditions on the same column are merged, so testing a row is a
+// couple of compares per column. Text with spaces goes in double quotes.
+
+enum class QueryKind : uint8_t { PolicyId, PolicyType, Int, Money, Date };
+
+struct QueryField {
+    const char *name;
+    QueryKind kind;
+    int width;   // table padding
+};
+
+// Column numbers are positions in these tables.
+enum class PolicyCol : uint8_t { Id, Type, Premium, Months, Client, Start, End, Paid };
+static const QueryField kPolicyQueryFields[] = {
+    {"id", QueryKind::PolicyId, 10}, {"type", QueryKind::PolicyType, 10}, {"premium", QueryKind::Money, 10},
+    {"months", QueryKind::Int, 8}, {"client", QueryKind::Int, 8}, {"start", QueryKind::Date, 12},
+    {"end", QueryKind::Date, 12}, {"paid", QueryKind::Money, 12},
+};
+// type and client come from the payment's policy.
+enum class PaymentCol : uint8_t { Policy, Amount, Date, Type, Client };
+static const QueryField kPaymentQueryFields[] = {
+    {"policy", QueryKind::PolicyId, 10}, {"amount", QueryKind::Money, 12}, {"date", QueryKind::Date, 12},
+    {"type", QueryKind::PolicyType, 10}, {"client", QueryKind::Int, 8},
+};
+
+struct QueryCond {
+    uint8_t col;
+    int64_t lo, hi;   // inclusive
+    bool negate;      // the value must fall outside [lo, hi]
+};
+
+struct Query {
+    bool payments = false;
+    vector<QueryCond> conds;   // at most one non-negated condition per column
+    bool none = false;         // the conditions contradict each other
+    vector<uint8_t> select;    // empty = every column
+    int sortCol = -1;
+    bool desc = false;
+    size_t limit = numeric_limits<size_t>::max();
+
+    const QueryField* fields(size_t &n) const {
+        n = payments ? size(kPaymentQueryFields) : size(kPolicyQueryFields);
+        return payments ? kPaymentQueryFields : kPolicyQueryFields;
+    }
+    // The merged range condition on col, if any.
+    const QueryCond* range(uint8_t col) const {
+        for (auto &c : conds) if (c.col == col && !c.negate) return &c;
+        return nullptr;
+    }
+    const QueryCond* equals(uint8_t col) const {
+        const QueryCond *c = range(col);
+        return c && c->lo == c->hi ? c : nullptr;
+    }
+};
+
+struct QueryToken {
+    string text;
+    bool quoted;
+};
+
+static bool lexQuery(string_view s, vector<QueryToken> &out, string &why) {
+    size_t i = 0;
+    while (i < s.size()) {
+        char c = s[i];
+        if (isspace((unsigned char)c)) { ++i; continue; }
+        if (c == '"') {
+            size_t e = s.find('"', i + 1);
+            if (e == string_view::npos) { why = "unterminated quote"; return false; }
+            out.push_back(QueryToken{string(s.substr(i + 1, e - i - 1)), true});
+            i = e + 1;
+            continue;
+        }
+        size_t len;
+        if (c == ',') len = 1;
+        else if (c == '<' || c == '>' || c == '=' || c == '!') len = i + 1 < s.size() && s[i + 1] == '=' ? 2 : 1;
+        else {
+            len = 0;
+            while (i + len < s.size() && !isspace((unsigned char)s[i + len]) && !strchr(",<>=!\"", s[i + len])) ++len;
+        }
+        out.push_back(QueryToken{string(s.substr(i, len)), false});
+        i += len;
+    }
+    return true;
+}
+
+// Compiles query text into q; false with why set if it does not parse.
+static bool parseQuery(string_view text, Query &q, string &why) {
+    vector<QueryToken> t;
+    if (!lexQuery(text, t, why)) return false;
+    size_t k = 0;
+    auto at = [&](const char *kw) {
+        if (k >= t.size() || t[k].quoted || t[k].text.size() != strlen(kw)) return false;
+        for (size_t i = 0; kw[i]; ++i) if (tolower((unsigned char)t[k].text[i]) != kw[i]) return false;
+        return true;
+    };
+    auto fail = [&](const string &msg) { why = msg; return false; };
+
+    if (at("policies")) q.payments = false;
+    else if (at("payments")) q.payments = true;
+    else return fail("query must start with policies or payments");
+    ++k;
+    size_t nf;
+    const QueryField *fields = q.fields(nf);
+    auto column = [&](uint8_t &col) {
+        if (k >= t.size() || t[k].quoted) return false;
+        for (size_t i = 0; i < nf; ++i) if (t[k].text == fields[i].name) { col = (uint8_t)i; ++k; return true; }
+        return false;
+    };
+    auto near = [&] { return k < t.size() ? "'" + t[k].text + "'" : string("end of query"); };
+
+    if (at("where")) ++k;
+    bool first = true;
+    while (k < t.size() && !at("select") && !at("sort") && !at("order") && !at("limit")) {
+        if (!first) {
+            if (!at("and")) return fail("expected 'and' before " + near());
+            ++k;
+        }
+        first = false;
+        uint8_t col;
+        if (!column(col)) return fail("unknown field " + near());
+        static const char *const ops[] = {"=", "==", "!=", "<", "<=", ">", ">="};
+        string op = k < t.size() && !t[k].quoted ? t[k].text : "";
+        if (find(begin(ops), end(ops), op) == end(ops)) return fail("expected a comparison before " + near());
+        if (++k >= t.size()) return fail("missing value after " + op);
+        const string &val = t[k++].text;
+
+        const QueryField &fd = fields[col];
+        int64_t v = 0;
+        switch (fd.kind) {
+            case QueryKind::PolicyId:
+            case QueryKind::PolicyType: {
+                if (op != "=" && op != "==" && op != "!=") return fail(string("only = and != apply to ") + fd.name);
+                uint32_t key;
+                Interner &in = fd.kind == QueryKind::PolicyId ? policyIds() : policyTypes();
+                v = in.find(val, key) ? (int64_t)key : -1;   // text never seen matches nothing
+                break;
+            }
+            case QueryKind::Int: {
+                int x;
+                if (!toInt(val, x)) return fail("invalid number '" + val + "'");
+                v = x;
+                break;
+            }
+            case QueryKind::Money: {
+                Money m;
+                if (!parseMoney(val, m)) return fail("invalid amount '" + val + "'");
+                v = m;
+                break;
+            }
+            case QueryKind::Date: {
+                Date d;
+                if (!parseDate(val, d)) return fail("invalid date '" + val + "'");
+                v = d.days;
+                break;
+            }
+        }
+
+        QueryCond c{col, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max(), op == "!="};
+        if (op == "=" || op == "==" || op == "!=") c.lo = c.hi = v;
+        else if (op == "<") c.hi = v - 1;
+        else if (op == "<=") c.hi = v;
+        else if (op == ">") c.lo = v + 1;
+        else c.lo = v;
+        // Unparseable dates kept from old files never satisfy a range.
+        if (fd.kind == QueryKind::Date && !c.negate) c.lo = max<int64_t>(c.lo, (int64_t)Date::invalid().days + 1);
+        QueryCond *same = nullptr;
+        if (!c.negate)
+            for (auto &o : q.conds) if (o.col == col && !o.negate) same = &o;
+        if (same) { same->lo = max(same->lo, c.lo); same->hi = min(same->hi, c.hi); }
+        else q.conds.push_back(c);
+    }
+    for (auto &c : q.conds) if (!c.negate && c.lo > c.hi) q.none = true;
+
+    if (at("select")) {
+        ++k;
+        do {
+            uint8_t col;
+            if (!column(col)) return fail("unknown field " + near());
+            q.select.push_back(col);
+        } while (k < t.size() && t[k].text == "," && !t[k].quoted && ++k);
+    }
+    if (at("sort") || at("order")) {
+        ++k;
+        if (at("by")) ++k;
+        uint8_t col;
+        if (!column(col)) return fail("unknown field " + near());
+        q.sortCol = col;
+        if (at("desc")) { q.desc = true; ++k; }
+        else if (at("asc")) ++k;
+    }
+    if (at("limit")) {
+        ++k;
+        if (k >= t.size() || !toSize(t[k].text, q.limit)) return fail("invalid limit");
+        ++k;
+    }
+    if (k < t.size()) return fail("unexpected " + near());
+    return true;
+}
+
+// Runs a parsed Query over pinned tables. When a condition pins a column an
+// index covers, the constructor (which, like a pin, runs under the caller's
+// lock) takes the candidate rows from it: a policy id or a payment's policy
+// (key -> row, payment chains), a client (the client chains) or an end-date
+// range (the end-date index). Otherwise every row is tested in parallel
+// partitions. Rows come out in table order unless sorted, whatever the plan.
+class QueryReport : public Report {
+    Query q;
+    PolicyService::View ps;
+    PaymentService::View pay;
+    bool indexed = false;
+    vector<uint32_t> candidates;   // ascending, when indexed
+    string plan;
+
+    int64_t policyValue(const Policy &p, uint8_t col) const {
+        switch ((PolicyCol)col) {
+            case PolicyCol::Id:      return p.getPolicyKey();
+            case PolicyCol::Type:    return p.getTypeKey();
+            case PolicyCol::Premium: return p.getPremium();
+            case PolicyCol::Months:  return p.getDuration();
+            case PolicyCol::Client:  return p.getClientId();
+            case PolicyCol::Start:   return p.getStartDate().days;
+            case PolicyCol::End: {
+                Date e;
+                return PolicyService::policyEndDate(p, e) ? e.days : Date::invalid().days;
+            }
+            case PolicyCol::Paid:    return pay.totalPaid(p.getPolicyKey());
+        }
+        return 0;
+    }
+    int64_t paymentValue(size_t row, uint8_t col) const {
+        switch ((PaymentCol)col) {
+            case PaymentCol::Policy: return pay.policyKeys[row];
+            case PaymentCol::Amount: return pay.amounts[row];
+            case PaymentCol::Date:   return pay.dates[row].days;
+            case PaymentCol::Type:
+            case PaymentCol::Client: {
+                const Policy *p = ps.findByKey(pay.policyKeys[row]);
+                if (!p) return -1;
+                return (PaymentCol)col == PaymentCol::Type ? (int64_t)p->getTypeKey() : p->getClientId();
+            }
+        }
+        return 0;
+    }
+    int64_t value(uint32_t row, uint8_t col) const {
+        return q.payments ? paymentValue(row, col) : policyValue(ps.rows[row], col);
+    }
+    bool matches(uint32_t row) const {
+        for (auto &c : q.conds) {
+            int64_t v = value(row, c.col);
+            if ((v >= c.lo && v <= c.hi) == c.negate) return false;
+        }
+        return true;
+    }
+
+    void usePaymentChain(uint32_t key) {
+        pay.forEachRowOf(key, [&](uint32_t r) { candidates.push_back(r); });
+    }
+
+public:
+    QueryReport(const PolicyService &p, const PaymentService &pm, Query query)
+        : q(move(query)), ps(p.pin()), pay(pm.pin()) {
+        indexed = true;
+        const QueryCond *c;
+        if (q.none) {
+            plan = "conditions exclude every row";
+        } else if (!q.payments) {
+            if ((c = q.equals((uint8_t)PolicyCol::Id))) {
+                plan = "policy id index";
+                if (c->lo >= 0 && c->lo < (int64_t)ps.rowOfKey.size() && ps.rowOfKey[c->lo] != kNoRow)
+                    candidates.push_back(ps.rowOfKey[c->lo]);
+            } else if ((c = q.equals((uint8_t)PolicyCol::Client))) {
+                plan = "client index";
+                candidates = p.rowsOfClientId((int)c->lo);
+            } else if ((c = q.range((uint8_t)PolicyCol::End))) {
+                plan = "end-date index";
+                auto day = [](int64_t d) { return Date{(int32_t)max<int64_t>(min<int64_t>(d, INT32_MAX), INT32_MIN)}; };
+                candidates = p.rowsEndingBetween(day(c->lo), day(c->hi));
+            } else {
+                indexed = false;
+            }
+        } else {
+            if ((c = q.equals((uint8_t)PaymentCol::Policy))) {
+                plan = "policy payment chain";
+                if (c->lo >= 0) usePaymentChain((uint32_t)c->lo);
+            } else if ((c = q.equals((uint8_t)PaymentCol::Client))) {
+                plan = "client index + payment chains";
+                for (uint32_t r : p.rowsOfClientId((int)c->lo)) usePaymentChain(ps.rows[r].getPolicyKey());
+            } else {
+                indexed = false;
+            }
+        }
+        if (!indexed) plan = "full scan";
+        sort(candidates.begin(), candidates.end());
+        // Columns read straight off the row are tested before ones that need
+        // a lookup (end date, ledger, the payment's policy).
+        stable_partition(q.conds.begin(), q.conds.end(), [&](const QueryCond &c) {
+            return q.payments ? c.col < (uint8_t)PaymentCol::Type : c.col < (uint8_t)PolicyCol::End;
+        });
+    }
+
+    void generate(RowSink &out) override {
+        static OpStats &stats = Metrics::get().op("report.Query"); OpTimer t(stats);
+        vector<uint32_t> rows;
+        if (indexed) {
+            for (uint32_t r : candidates) if (matches(r)) rows.push_back(r);
+        } else {
+            size_t n = q.payments ? pay.size() : ps.rows.size();
+            rows = gatherPartitions<uint32_t>(n, CowVector<Policy>::kChunk,
+                [&](size_t b, size_t e, vector<uint32_t> &part) {
+                    for (size_t i = b; i < e; ++i) if (matches((uint32_t)i)) part.push_back((uint32_t)i);
+                });
+        }
 
-    void setPolicyId(const string &pid) { policyId = pid; }
-    void setAmount(double a) { amount = a; }
-    void setDate(const string &d) { date = d; }
+        size_t nf;
+        const QueryField *fields = q.fields(nf);
+        if (q.sortCol >= 0) {
+            uint8_t sc = (uint8_t)q.sortCol;
+            QueryKind kind = fields[sc].kind;
+            bool text = kind == QueryKind::PolicyId || kind == QueryKind::PolicyType;
+            Interner &in = kind == QueryKind::PolicyId ? policyIds() : policyTypes();
+            // Sort keys are extracted once; ties keep table order either way.
+            struct Key { int64_t v; string_view s; uint32_t row; };
+            vector<Key> keys;
+            keys.reserve(rows.size());
+            for (uint32_t r : rows) {
+                int64_t v = value(r, sc);
+                keys.push_back(Key{v, text && v >= 0 ? in.str((uint32_t)v) : string_view(), r});
+            }
+            bool desc = q.desc;
+            auto less = [&](const Key &a, const Key &b) {
+                int d = text ? a.s.compare(b.s) : (a.v < b.v ? -1 : a.v > b.v);
+                if (d) return desc ? d > 0 : d < 0;
+                return a.row < b.row;
+            };
+            if (q.limit < keys.size()) {
+                partial_sort(keys.begin(), keys.begin() + q.limit, keys.end(), less);
+                keys.resize(q.limit);
+            } else {
+                sort(keys.begin(), keys.end(), less);
+            }
+            rows.clear();
+            for (auto &k : keys) rows.push_back(k.row);
+        }
+        if (rows.size() > q.limit) rows.resize(q.limit);
 
-    static Payment fromRecord(const string &line) {
-        // policyId|amount|date
-        auto v = split(line, '|');
-        Payment pm;
-        if (v.size()==3) {
-            pm.policyId = v[0];
-            pm.amount = atof(v[1].c_str());
-            pm.date = v[2];
+        out.note("Plan: " + plan + ", " + to_string(rows.size()) + " row(s)");
+        vector<uint8_t> cols = q.select;
+        if (cols.empty()) for (size_t i = 0; i < nf; ++i) cols.push_back((uint8_t)i);
+        vector<ReportColumn> header;
+        for (uint8_t c : cols) header.push_back(ReportColumn{fields[c].name, fields[c].width});
+        out.begin(move(header));
+        for (uint32_t r : rows) {
+            for (uint8_t c : cols) {
+                int64_t v = value(r, c);
+                switch (fields[c].kind) {
+                    case QueryKind::PolicyId:   out.cell(v >= 0 ? policyIds().str((uint32_t)v) : string_view()); break;
+                    case QueryKind::PolicyType: out.cell(v >= 0 ? policyTypes().str((uint32_t)v) : string_view()); break;
+                    case QueryKind::Int:        out.cell((long long)v); break;
+                    case QueryKind::Money:      out.cellMoney(v); break;
+                    case QueryKind::Date:       out.cellDate(Date{(int32_t)v}); break;
+                }
+            }
+            out.endRow();
         }
-        return pm;
-    }
-    string toRecord() const {
-        return join({policyId, to_string((long double)amount), date}, '|');
     }
 };
 
 
-//Services (Main functions for my app)
-class ClientService {
-    vector<Client> clients;
-    string filename;
-public:
-    ClientService(const string &file="clients.txt") : filename(file) { load(); }
+//Tooling: synthetic datasets and a service-layer benchmark (see main()).
+struct GenConfig {
+    size_t clients = 1000;
+    size_t policies = 2500;
+    size_t payments = 10000;
+    double skew = 2.0;            // >1 piles payments onto a few policies
+    Date from = fromCivil(2015, 1, 1);
+    Date to = fromCivil(2025, 12, 31);
+    uint64_t seed = 42;
+};
 
-    void load() {
-        clients.clear();
-        ifstream in(filename);
-        if (!in) return;
-        string line;
-        while (getline(in, line)) {
-            line = trim(line);
-            if (line.empty()) continue;
-            clients.push_back(Client::fromRecord(line));
+// Writes clients.txt / policies.txt / payments.txt under dir in the normal
+// record formats, so every loader path can be exercised at scale.
+static void generateDataset(const string &dir, const GenConfig &cfg) {
+    static const char *firsts[] = {"Asha","Bob","Chen","Dev","Elena","Farah","Gopal","Hana","Ivan","Jia",
+                                   "Kiran","Lena","Mohan","Nina","Omar","Priya","Quinn","Ravi","Sara","Tariq"};
+    static const char *lasts[] = {"Sharma","Smith","Wang","Iyer","Garcia","Khan","Patel","Sato","Novak","Li",
+                                  "Rao","Brown","Mehta","Silva","Ali","Gupta","Reyes","Nair","Cohen","Singh"};
+    static const char *cities[] = {"Noida","Gurgaon","Bangalore","Mumbai","Pune","Chennai","Delhi","Hyderabad"};
+    static const char *types[] = {"Life","Health","Auto","Home","Travel"};
+    mt19937_64 rng(cfg.seed);
+    auto pick = [&](size_t n) { return (size_t)(rng() % n); };
+    int span = max(1, cfg.to.days - cfg.from.days);
+    filesystem::create_directories(dir);
+
+    {
+        ofstream out(dir + "/clients.txt");
+        for (size_t i = 0; i < cfg.clients; ++i) {
+            string name = string(firsts[pick(20)]) + " " + lasts[pick(20)];
+            Client c((int)(1001 + i), name, 18 + (int)pick(60), to_string(9000000000ULL + pick(999999999)),
+                     cities[pick(8)]);
+            out << c.toRecord() << "\n";
         }
     }
-    
-    void save() {
-        ofstream out(filename);
-        for (auto &c : clients) out << c.toRecord() << "\n";
-    }
 
-    int nextId() const {
-        int mx = 1000;
-        for (auto &c : clients) mx = max(mx, c.getId());
-        return mx + 1;
+    vector<Money> premiums(cfg.policies);
+    vector<Date> starts(cfg.policies);
+    vector<int> durations(cfg.policies);
+    {
+        ofstream out(dir + "/policies.txt");
+        for (size_t i = 0; i < cfg.policies; ++i) {
+            premiums[i] = (Money)(500 + pick(4500)) * 100;
+            durations[i] = 6 * (1 + (int)pick(10));
+            starts[i] = Date{cfg.from.days + (int32_t)pick((size_t)span)};
+            Policy p;
+            p.setPolicyId("P" + to_string(1001 + i));
+            p.setType(types[pick(5)]);
+            p.setPremium(premiums[i]);
+            p.setDuration(durations[i]);
+            p.setClientId(cfg.clients ? (int)(1001 + pick(cfg.clients)) : 0);
+            p.setStartDate(starts[i]);
+            out << p.toRecord() << "\n";
+        }
     }
 
-    bool addClient(const string &name, int age, const string &contact, const string &addr, int &outId) {
-        Client c(nextId(), name, age, contact, addr);
-        clients.push_back(c);
-        save();
-        outId = c.getId();
-        return true;
+    {
+        ofstream out(dir + "/payments.txt");
+        uniform_real_distribution<double> u(0.0, 1.0);
+        for (size_t i = 0; i < cfg.payments && cfg.policies; ++i) {
+            size_t k = min(cfg.policies - 1, (size_t)(pow(u(rng), cfg.skew) * cfg.policies));
+            Date end = addMonths(starts[k], durations[k]);
+            int window = max(1, min(end.days, cfg.to.days) - starts[k].days);
+            Date when{starts[k].days + (int32_t)pick((size_t)window)};
+            Money amt = pick(10) == 0 ? premiums[k] / 2 : premiums[k];   // some partial payments
+            out << Payment("P" + to_string(1001 + k), amt, when).toRecord() << "\n";
+        }
     }
+}
 
-    Client* findById(int id) {
-        for (auto &c : clients) if (c.getId()==id) return &c;
-        return nullptr;
+class BenchTimer {
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+public:
+    double ms() const {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
     }
+};
 
-    vector<Client*> findByName(const string &kw) {
-        vector<Client*> out;
-        string needle = kw; transform(needle.begin(), needle.end(), needle.begin(), ::tolower);
-        for (auto &c : clients) {
-            string n = c.getName();
-            transform(n.begin(), n.end(), n.begin(), ::tolower);
-            if (n.find(needle) != string::npos) out.push_back(&c);
-        }
-        return out;
-    }
+static void benchRow(const string &op, size_t rows, size_t ops, double ms) {
+    cout << left << setw(32) << op << setw(12) << rows << setw(10) << ops
+         << setw(14) << fixed << setprecision(2) << ms
+         << setprecision(0) << (ops ? ms * 1e6 / ops : 0.0) << defaultfloat << "\n";
+}
 
-    bool updateClient(int id, const string &name, const string &ageStr,const string &contact, const string &addr) {
-        Client *c = findById(id);
-        if (!c) return false;
-        if (!name.empty()) c->setName(name);
-        if (!ageStr.empty() && isNumber(ageStr)) c->setAge(stoi(ageStr));
-        if (!contact.empty()) c->setContact(contact);
-        if (!addr.empty()) c->setAddress(addr);
-        save();
-        return true;
+// Times load/save, point lookups, searches and every report on a generated
+// book of `rows` payments (policies = rows/4, clients = rows/10).
+static void runBenchmark(size_t rows) {
+    GenConfig cfg;
+    cfg.payments = rows;
+    cfg.policies = max<size_t>(1, rows / 4);
+    cfg.clients = max<size_t>(1, rows / 10);
+    string dir = (filesystem::temp_directory_path() / ("insurance-bench-" + to_string(rows))).string();
+    filesystem::remove_all(dir);
+
+    BenchTimer tg;
+    generateDataset(dir, cfg);
+    benchRow("generate", rows, 1, tg.ms());
+
+    unique_ptr<ClientService> cs;
+    unique_ptr<PolicyService> ps;
+    unique_ptr<PaymentService> pay;
+    auto loadAll = [&](const string &label) {
+        BenchTimer t1; cs.reset(new ClientService(dir + "/clients.txt"));    benchRow(label + " clients", cfg.clients, 1, t1.ms());
+        BenchTimer t2; ps.reset(new PolicyService(dir + "/policies.txt"));   benchRow(label + " policies", cfg.policies, 1, t2.ms());
+        BenchTimer t3; pay.reset(new PaymentService(dir + "/payments.txt")); benchRow(label + " payments", rows, 1, t3.ms());
+    };
+    loadAll("load(text)");
+    loadAll("load(snapshot)");
+    {
+        BenchTimer t;
+        cs.reset(new ClientService(dir + "/clients.txt", StorageMode::Journaled, FlushPolicy(), false));
+        ps.reset(new PolicyService(dir + "/policies.txt", StorageMode::Journaled, FlushPolicy(), false));
+        pay.reset(new PaymentService(dir + "/payments.txt", StorageMode::Journaled, FlushPolicy(), false));
+        thread c([&] { cs->load(); });
+        thread p([&] { ps->load(); });
+        pay->load();
+        c.join(); p.join();
+        benchRow("load(snapshot) all concurrent", rows, 1, t.ms());
     }
 
-    bool removeClient(int id, bool hasPolicies) {
-        if (hasPolicies) return false;
-        auto it = remove_if(clients.begin(), clients.end(),
-                            [&](const Client &c){ return c.getId()==id; });
-        if (it==clients.end()) return false;
-        clients.erase(it, clients.end());
-        save();
-        return true;
+    { BenchTimer t; cs->save();  benchRow("save clients", cfg.clients, 1, t.ms()); }
+    { BenchTimer t; ps->save();  benchRow("save policies", cfg.policies, 1, t.ms()); }
+    { BenchTimer t; pay->save(); benchRow("save payments", rows, 1, t.ms()); }
+
+    const size_t lookups = 100000;
+    mt19937_64 rng(7);
+    size_t hits = 0;
+    {
+        BenchTimer t;
+        for (size_t i = 0; i < lookups; ++i) hits += cs->findById((int)(1001 + rng() % cfg.clients)) != nullptr;
+        benchRow("ClientService::findById", cfg.clients, lookups, t.ms());
+    }
+    {
+        static const char *needles[] = {"sha", "an", "Priya", "ng", "Omar Ali", "x"};
+        BenchTimer t;
+        for (const char *n : needles) hits += cs->findByName(n, 50).size();
+        benchRow("ClientService::findByName", cfg.clients, 6, t.ms());
+    }
+    vector<string> pids;
+    for (size_t i = 0; i < 1000; ++i) pids.push_back("P" + to_string(1001 + rng() % cfg.policies));
+    {
+        BenchTimer t;
+        for (size_t i = 0; i < lookups; ++i) hits += ps->findByPolicyId(pids[i % pids.size()]) != nullptr;
+        benchRow("PolicyService::findByPolicyId", cfg.policies, lookups, t.ms());
+    }
+    {
+        BenchTimer t;
+        for (size_t i = 0; i < 100; ++i) hits += pay->findByPolicyId(pids[i]).size();
+        benchRow("PaymentService::findByPolicyId", rows, 100, t.ms());
+    }
+    {
+        BenchTimer t;
+        Money sum = 0;
+        for (size_t i = 0; i < lookups; ++i) sum += pay->totalPaid(pids[i % pids.size()]);
+        hits += sum != 0;
+        benchRow("PaymentService::totalPaid", rows, lookups, t.ms());
     }
 
-    const vector<Client>& getAll() const { return clients; }
-};
+    // Reports format into a sink that discards its buffer, so only the work is timed.
+    auto report = [&](const string &name, Report &r, SinkFormat f = SinkFormat::Table) {
+        unique_ptr<RowSink> sink;
+        if (f == SinkFormat::Csv) sink = make_unique<CsvSink>((FILE*)nullptr);
+        else if (f == SinkFormat::Jsonl) sink = make_unique<JsonlSink>((FILE*)nullptr);
+        else sink = make_unique<TableSink>((FILE*)nullptr);
+        BenchTimer t;
+        r.generate(*sink);
+        sink->flush();
+        benchRow(name, cfg.policies, 1, t.ms());
+    };
+    { AllClientsReport r(*cs);                    report("AllClientsReport", r); }
+    { AllPoliciesReport r(*ps);                   report("AllPoliciesReport", r); }
+    { AllPoliciesReport r(*ps);                   report("AllPoliciesReport(csv)", r, SinkFormat::Csv); }
+    { AllPoliciesReport r(*ps);                   report("AllPoliciesReport(jsonl)", r, SinkFormat::Jsonl); }
+    { ExpiringPoliciesReport r(*ps, *cs, 12);     report("ExpiringPoliciesReport", r); }
+    { UnpaidClientsReport r(*ps, *cs, *pay);      report("UnpaidClientsReport", r); }
+    { PortfolioTotalsReport r(*ps, *pay);         report("PortfolioTotalsReport", r); }
+    { ReceivablesAgingReport r(*ps, *pay);        report("ReceivablesAgingReport", r); }
+    { CashFlowProjectionReport r(*ps, *pay, 120, cfg.from); report("CashFlowProjectionReport(120m)", r); }
+    // Ad-hoc queries: parallel scans (one joining payments to policies) and an index lookup.
+    auto query = [&](const string &name, const char *text) {
+        Query q;
+        string why;
+        if (!parseQuery(text, q, why)) return;
+        QueryReport r(*ps, *pay, move(q));
+        report(name, r);
+    };
+    query("Query(policy scan+sort)", "policies type=Health and premium>500 sort premium desc limit 100");
+    query("Query(payment scan+join)", "payments type=Health and amount>1000 limit 100");
+    query("Query(client index)", "policies client=1001");
 
-class PolicyService {
-    vector<Policy> policies;
-    string filename;
-public:
-    PolicyService(const string &file="policies.txt") : filename(file) { load(); }
+    // Onboarding: one batch per table (validated, applied, persisted once)
+    // against the same kind of row added one at a time.
+    {
+        size_t n = max<size_t>(1, rows / 10);
+        string why;
+        vector<Client> newClients;
+        newClients.reserve(n);
+        for (size_t i = 0; i < n; ++i) newClients.emplace_back(0, "Bulk Client " + to_string(i), 30, "9000000000", "Pune");
+        BenchTimer t1;
+        hits += cs->addClients(newClients, why);
+        benchRow("ClientService::addClients", cfg.clients, n, t1.ms());
 
-    void load() {
-        policies.clear();
-        ifstream in(filename);
-        if (!in) return;
-        string line;
-        while (getline(in, line)) {
-            line = trim(line);
-            if (line.empty()) continue;
-            policies.push_back(Policy::fromRecord(line));
+        vector<Policy> newPolicies(n);
+        for (size_t i = 0; i < n; ++i) {
+            newPolicies[i].setClientId(newClients[i].getId());
+            newPolicies[i].setType("Life");
+            newPolicies[i].setPremium(100000);
+            newPolicies[i].setDuration(12);
+            newPolicies[i].setStartDate(cfg.from);
         }
+        BenchTimer t2;
+        hits += ps->addPolicies(newPolicies, *cs, why);
+        benchRow("PolicyService::addPolicies", cfg.policies, n, t2.ms());
+
+        vector<Payment> newPayments;
+        newPayments.reserve(n);
+        for (auto &p : newPolicies) newPayments.emplace_back(p.getPolicyKey(), p.getPremium(), addMonths(cfg.from, 1));
+        BenchTimer t3;
+        hits += pay->recordPayments(newPayments, *ps, why);
+        benchRow("PaymentService::recordPayments", rows, n, t3.ms());
+
+        const size_t singles = 1000;
+        string pid;
+        BenchTimer t4;
+        for (size_t i = 0; i < singles; ++i)
+            hits += ps->addPolicy(newClients[i % n].getId(), "Life", 100000, 12, "2020-01-01", pid);
+        benchRow("PolicyService::addPolicy", cfg.policies, singles, t4.ms());
     }
-    
-    void save() {
-        ofstream out(filename);
-        for (auto &p : policies) out << p.toRecord() << "\n";
-    }
 
-    string nextPolicyId() const {
-        int mx = 1000;
-        for (auto &p : policies) {
-            const string &pid = p.getPolicyId();
-            if (!pid.empty() && (pid[0]=='P' || pid[0]=='p')) {
-                string num = pid.substr(1);
-                if (isNumber(num)) mx = max(mx, stoi(num));
+    cout << "(checksum " << hits << ")\n";
+    cs.reset(); ps.reset(); pay.reset();
+    filesystem::remove_all(dir);
+}
+
+
+//Bulk CSV import/export (see Application::importPolicies / exportTable).
+// Import is a pipeline: a reader thread cuts the file into blocks at record
+// boundaries, each round of blocks is parsed and validated on the pool, and
+// the round is applied in file order through the batch APIs. At most two
+// rounds of text (2 blocks per thread each) are held at once, so the file
+// may be larger than memory.
+static const size_t kImportBlockBytes = 1 << 20;
+// A record still open after this many bytes (in practice a quote that is
+// never closed) is rejected rather than buffered.
+static const size_t kMaxCsvRecordBytes = 1 << 20;
+
+// Appends s as one CSV field, quoted only when it needs to be (as CsvSink does).
+static void csvField(string &out, string_view s) {
+    if (s.find_first_of(",\"\r\n") == string_view::npos) { out.append(s.data(), s.size()); return; }
+    out.push_back('"');
+    for (char ch : s) { if (ch == '"') out.push_back('"'); out.push_back(ch); }
+    out.push_back('"');
+}
+
+// One quoting rule for every CSV scan, the one splitCsvFields applies: a '"'
+// opens a quoted field only as the field's first character; inside it ""
+// is a literal quote and a lone '"' closes it. Anywhere else a quote is an
+// ordinary character, so a stray one cannot swallow the rest of the file.
+// Returns the offset of the '\n' ending the record that starts at `from`,
+// or npos if s runs out first.
+static size_t csvRecordEnd(string_view s, size_t from) {
+    size_t nl = s.find('\n', from);
+    if (!memchr(s.data() + from, '"', (nl == string_view::npos ? s.size() : nl) - from)) return nl;
+    bool fieldStart = true;
+    for (size_t i = from; i < s.size(); ++i) {
+        char c = s[i];
+        if (c == '"' && fieldStart) {
+            for (++i; ; ++i) {
+                if (i >= s.size()) return string_view::npos;
+                if (s[i] != '"') continue;
+                if (i + 1 < s.size() && s[i + 1] == '"') { ++i; continue; }
+                break;
             }
+            fieldStart = false;
+            continue;
         }
-        return string("P") + to_string(mx + 1);
+        if (c == '\n') return i;
+        fieldStart = c == ',';
     }
+    return string_view::npos;
+}
 
-    bool addPolicy(int clientId, const string &type, double premium, int months, const string &start, string &outPid) {
-        Policy p;
-        p.setClientId(clientId);
-        p.setType(type);
-        p.setPremium(premium);
-        p.setDuration(months);
-        Date dt;
-        if (!parseDate(start, dt)) {
-            p.setStartDate(dateToString(todayApprox()));
-        } else {
-            p.setStartDate(start);
-        }
-        p.setPolicyId(nextPolicyId());
-        policies.push_back(p);
-        save();
-        outPid = p.getPolicyId();
-        return true;
+// Length of the prefix of s that ends at a record boundary; s must start at
+// a record start.
+static size_t csvCompletePrefix(string_view s) {
+    if (s.find('"') == string_view::npos) {
+        size_t nl = s.rfind('\n');
+        return nl == string_view::npos ? 0 : nl + 1;
     }
+    size_t pos = 0;
+    for (size_t e; (e = csvRecordEnd(s, pos)) != string_view::npos; ) pos = e + 1;
+    return pos;
+}
 
-    Policy* findByPolicyId(const string &pid) {
-        for (auto &p : policies) if (p.getPolicyId()==pid) return &p;
-        return nullptr;
-    }
-    
-    vector<Policy*> findByClientId(int cid) {
-        vector<Policy*> out;
-        for (auto &p : policies) if (p.getClientId()==cid) out.push_back(&p);
-        return out;
+// fn(record, line) for every non-blank record of data, whose first line is
+// `line`. A quoted field may span lines.
+template <class Fn>
+static void forEachCsvRecord(string_view data, size_t line, Fn fn) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = min(csvRecordEnd(data, pos), data.size());
+        string_view rec = data.substr(pos, end - pos);
+        size_t breaks = (size_t)count(rec.begin(), rec.end(), '\n');
+        if (!rec.empty() && rec.back() == '\r') rec.remove_suffix(1);
+        if (!trimView(rec).empty()) fn(rec, line);
+        line += breaks + 1;
+        pos = end + 1;
     }
+}
 
-    bool updatePolicy(const string &pid, const string &type, const string &prem,const string &months, const string &start) {
-        Policy *p = findByPolicyId(pid);
-        if (!p) return false;
-        if (!type.empty()) p->setType(type);
-        if (!prem.empty()) p->setPremium(atof(prem.c_str()));
-        if (!months.empty() && isNumber(months)) p->setDuration(stoi(months));
-        if (!start.empty()) {
-            Date dt;
-            if (parseDate(start, dt)) p->setStartDate(start);
+// Splits one RFC 4180 record into up to N fields and returns how many it
+// has. Quoted fields are unescaped into scratch (sized up front, so the
+// views stay valid); unquoted ones are trimmed views into rec.
+template <size_t N>
+static size_t splitCsvFields(string_view rec, array<string_view, N> &out, string &scratch) {
+    scratch.clear();
+    scratch.reserve(rec.size());
+    size_t n = 0, i = 0;
+    for (;;) {
+        string_view f;
+        if (i < rec.size() && rec[i] == '"') {
+            size_t start = scratch.size();
+            for (++i; i < rec.size(); ++i) {
+                if (rec[i] == '"') {
+                    if (i + 1 < rec.size() && rec[i + 1] == '"') { scratch.push_back('"'); ++i; continue; }
+                    ++i;
+                    break;
+                }
+                scratch.push_back(rec[i]);
+            }
+            f = string_view(scratch.data() + start, scratch.size() - start);
+            i = min(rec.find(',', i), rec.size());
+        } else {
+            size_t comma = min(rec.find(',', i), rec.size());
+            f = trimView(rec.substr(i, comma - i));
+            i = comma;
         }
-        save();
-        return true;
+        if (n < N) out[n] = f;
+        ++n;
+        if (i >= rec.size()) return n;
+        ++i;
     }
+}
 
-    bool removePolicy(const string &pid, bool hasPayments) {
-        if (hasPayments) return false;
-        auto it = remove_if(policies.begin(), policies.end(),
-                            [&](const Policy &p){ return p.getPolicyId()==pid; });
-        if (it==policies.end()) return false;
-        policies.erase(it, policies.end());
-        save();
-        return true;
-    }
+template <class Row>
+struct ImportRow {
+    Row row;
+    size_t line;
+    string_view text;   // into the round's block
+};
 
-    // Business helpers
-    static bool policyEndDate(const Policy &p, Date &endDate) {
-        Date st;
-        if (!parseDate(p.getStartDate(), st)) return false;
-        endDate = addMonths(st, p.getDuration());
-        return true;
-    }
+struct ImportReject {
+    size_t line;
+    string text;
+    string why;
+};
 
-    const vector<Policy>& getAll() const { return policies; }
+struct ImportResult {
+    size_t imported = 0, rejected = 0;
+    string rejectPath;   // empty if nothing was rejected
 };
 
-class PaymentService {
-    vector<Payment> payments;
-    string filename;
-public:
-    PaymentService(const string &file="payments.txt") : filename(file) { load(); }
+// A run of whole records starting at line firstLine, or (text empty) the
+// reject for an overlong one.
+struct CsvBlock { string text; size_t firstLine; vector<ImportReject> bad; };
 
-    void load() {
-        payments.clear();
-        ifstream in(filename);
-        if (!in) return;
-        string line;
-        while (getline(in, line)) {
-            line = trim(line);
-            if (line.empty()) continue;
-            payments.push_back(Payment::fromRecord(line));
+// Cuts the file into blocks of about kImportBlockBytes at record boundaries
+// and hands each to emit(CsvBlock&&), in order. An overlong record is
+// rejected by its first line (cut to the limit), and reading resumes after
+// that line, so the carry stays bounded.
+template <class Emit>
+static void readCsvBlocks(FILE *in, const string &path, Emit emit) {
+    string carry;
+    size_t line = 1;
+    bool skipping = false;   // dropping the rest of an overlong line
+    vector<char> buf(kImportBlockBytes);
+    for (bool last = false; !last; ) {
+        size_t got = fread(buf.data(), 1, buf.size(), in);
+        Metrics::get().bytesRead(path, got);
+        last = got == 0;
+        string_view more(buf.data(), got);
+        if (skipping) {
+            size_t nl = more.find('\n');
+            if (nl == string_view::npos) continue;
+            more.remove_prefix(nl + 1);
+            skipping = false;
+            ++line;
+        }
+        carry.append(more.data(), more.size());
+        for (;;) {
+            size_t cut = last ? carry.size() : csvCompletePrefix(carry);
+            if (cut && (last || carry.size() >= kImportBlockBytes)) {
+                CsvBlock b{carry.substr(0, cut), line, {}};
+                line += (size_t)count(b.text.begin(), b.text.end(), '\n');
+                carry.erase(0, cut);
+                emit(move(b));
+            }
+            if (last || carry.size() <= kMaxCsvRecordBytes) break;
+            size_t nl = carry.find('\n');
+            CsvBlock b{string(), line, {}};
+            b.bad.push_back(ImportReject{line, carry.substr(0, min(nl, kMaxCsvRecordBytes)),
+                                         "record longer than " + to_string(kMaxCsvRecordBytes) + " bytes"});
+            if (nl == string_view::npos) { skipping = true; carry.clear(); }
+            else { carry.erase(0, nl + 1); ++line; }
+            emit(move(b));
         }
     }
-    
-    void save() {
-        ofstream out(filename);
-        for (auto &pm : payments) out << pm.toRecord() << "\n";
-    }
+}
 
-    void recordPayment(const string &pid, double amount, const string &dateStr) {
-        Date dt;
-        string d = dateStr;
-        if (!parseDate(d, dt)) d = dateToString(todayApprox());
-        payments.emplace_back(pid, amount, d);
-        save();
-    }
+// fn(field) with the first field of every record importCsv would read from
+// path, in file order; false if the file cannot be opened. Lets an import
+// see keys from the whole file before it applies its first row.
+template <class Fn>
+static bool forEachCsvFirstField(const string &path, Fn fn) {
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in) return false;
+    array<string_view, 1> f;
+    string scratch;
+    readCsvBlocks(in, path, [&](CsvBlock &&b) {
+        forEachCsvRecord(b.text, b.firstLine, [&](string_view rec, size_t) {
+            if (!rec.empty() && rec[0] == '"') splitCsvFields(rec, f, scratch);
+            else f[0] = trimView(rec.substr(0, rec.find(',')));
+            fn(f[0]);
+        });
+    });
+    fclose(in);
+    return true;
+}
 
-    vector<Payment> findByPolicyId(const string &pid) const {
-        vector<Payment> out;
-        for (auto &pm : payments) if (pm.getPolicyId()==pid) out.push_back(pm);
-        sort(out.begin(), out.end(), [](const Payment &a, const Payment &b){
-            Date da, db;
-            bool pa = parseDate(a.getDate(), da);
-            bool pb = parseDate(b.getDate(), db);
-            if (pa && pb) return cmpDate(da, db) < 0;
-            return a.getDate() < b.getDate();
+// parse(fields, n, row, why) runs on pool threads and sees the tables as
+// they stood when the round started. apply(good, rejects) runs on this
+// thread, in file order, and must move any row it refuses into rejects;
+// it returns how many rows it applied. A first record whose first field is
+// headerField is taken as a header. Rejected records are written to
+// rejectPath unchanged, followed by an "error" column.
+template <class Row, size_t N, class Parse, class Apply>
+static bool importCsv(const string &path, const string &rejectPath, string_view headerField,
+                      Parse parse, Apply apply, ImportResult &res) {
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in) return false;
+    remove(rejectPath.c_str());   // a previous run's rejects
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t perRound = max<size_t>(2, pool.size() * 2);
+
+    mutex mu;
+    condition_variable changed;
+    deque<CsvBlock> ready;
+    bool eof = false;
+    thread reader([&] {
+        readCsvBlocks(in, path, [&](CsvBlock &&b) {
+            unique_lock<mutex> lk(mu);
+            changed.wait(lk, [&] { return ready.size() < perRound; });
+            ready.push_back(move(b));
+            changed.notify_all();
         });
-        return out;
-    }
+        lock_guard<mutex> lk(mu);
+        eof = true;
+        changed.notify_all();
+    });
 
-    double totalPaid(const string &pid) const {
-        double s=0.0;
-        for (auto &pm : payments) if (pm.getPolicyId()==pid) s += pm.getAmount();
-        return s;
-    }
+    FILE *rej = nullptr;
+    string header;
+    for (;;) {
+        vector<CsvBlock> round;
+        {
+            unique_lock<mutex> lk(mu);
+            changed.wait(lk, [&] { return eof || !ready.empty(); });
+            while (!ready.empty() && round.size() < perRound) { round.push_back(move(ready.front())); ready.pop_front(); }
+            changed.notify_all();
+        }
+        if (round.empty()) break;
 
-    bool hasPayments(const string &pid) const {
-        for (auto &pm : payments) if (pm.getPolicyId()==pid) return true;
-        return false;
-    }
+        struct Parsed { vector<ImportRow<Row>> good; vector<ImportReject> bad; string header; };
+        vector<Parsed> parsed(round.size());
+        pool.parallelFor(round.size(), [&](size_t k) {
+            Parsed &out = parsed[k];
+            array<string_view, N> f;
+            string scratch, why;
+            forEachCsvRecord(round[k].text, round[k].firstLine, [&](string_view rec, size_t line) {
+                size_t n = splitCsvFields(rec, f, scratch);
+                if (line == 1 && n && f[0] == headerField) { out.header = string(rec); return; }
+                Row row;
+                if (parse(f, n, row, why)) out.good.push_back(ImportRow<Row>{move(row), line, rec});
+                else out.bad.push_back(ImportReject{line, string(rec), why});
+            });
+        });
 
-    void deletePaymentsOf(const string &pid) {
-        auto it = remove_if(payments.begin(), payments.end(),
-                            [&](const Payment &pm){ return pm.getPolicyId()==pid; });
-        if (it != payments.end()) {
-            payments.erase(it, payments.end());
-            save();
+        vector<ImportRow<Row>> good;
+        vector<ImportReject> bad;
+        for (auto &b : round) bad.insert(bad.end(), make_move_iterator(b.bad.begin()), make_move_iterator(b.bad.end()));
+        for (auto &p : parsed) {
+            if (!p.header.empty()) header = move(p.header);
+            good.insert(good.end(), make_move_iterator(p.good.begin()), make_move_iterator(p.good.end()));
+            bad.insert(bad.end(), make_move_iterator(p.bad.begin()), make_move_iterator(p.bad.end()));
         }
-    }
+        res.imported += apply(good, bad);
+        if (bad.empty()) continue;
 
-    const vector<Payment>& getAll() const { return payments; }
-};
+        sort(bad.begin(), bad.end(), [](const ImportReject &a, const ImportReject &b) { return a.line < b.line; });
+        if (!rej) {
+            rej = fopen(rejectPath.c_str(), "wb");
+            if (!rej) break;
+            res.rejectPath = rejectPath;
+            if (!header.empty()) fprintf(rej, "%s,error\n", header.c_str());
+        }
+        string out;
+        for (auto &b : bad) {
+            out.append(b.text);
+            out.push_back(',');
+            csvField(out, "line " + to_string(b.line) + ": " + b.why);
+            out.push_back('\n');
+        }
+        fwrite(out.data(), 1, out.size(), rej);
+        Metrics::get().bytesWritten(rejectPath, out.size());
+        res.rejected += bad.size();
+    }
 
-// Business login for my reference
-static int approxMonthsPaid(double monthlyPremium, double totalPaid) {
-    if (monthlyPremium <= 0) return 0;
-    return (int)floor(totalPaid / monthlyPremium);
+    {
+        // Only reached early if the rejects file could not be opened.
+        lock_guard<mutex> lk(mu);
+        ready.clear();
+    }
+    changed.notify_all();
+    bool ok = true;
+    if (!eof) {
+        // Drain the reader so it can finish.
+        for (;;) {
+            unique_lock<mutex> lk(mu);
+            changed.wait(lk, [&] { return eof || !ready.empty(); });
+            ready.clear();
+            changed.notify_all();
+            if (eof) break;
+        }
+        ok = false;
+    }
+    reader.join();
+    fclose(in);
+    if (rej && fclose(rej) != 0) ok = false;
+    return ok;
 }
 
-static bool nextDueDate(const Policy &p, const PaymentService &paySvc, Date &due) {
-    Date st;
-    if (!parseDate(p.getStartDate(), st)) return false;
-    double paid = paySvc.totalPaid(p.getPolicyId());
-    int monthsPaid = approxMonthsPaid(p.getPremium(), paid);
-    if (monthsPaid >= p.getDuration()) return false; // finished
-    due = addMonths(st, monthsPaid + 1);
-    return true;
+// Writes a header and fmt(i, out) for rows [0, n). Rows are formatted in
+// parallel partitions, a bounded round at a time, and written in order.
+template <class Fmt>
+static bool exportCsv(const string &path, string_view header, size_t n, Fmt fmt) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    const size_t grain = 16384;
+    const size_t round = grain * 4 * ThreadPool::shared().size();
+    uint64_t bytes = header.size() + 1;
+    fwrite(header.data(), 1, header.size(), f);
+    fputc('\n', f);
+    for (size_t b = 0; b < n; b += round) {
+        vector<string> parts = gatherPartitions<string>(min(round, n - b), grain,
+            [&](size_t lo, size_t hi, vector<string> &out) {
+                string s;
+                s.reserve((hi - lo) * 48);
+                for (size_t i = lo; i < hi; ++i) { fmt(b + i, s); s.push_back('\n'); }
+                out.push_back(move(s));
+            });
+        for (auto &s : parts) { fwrite(s.data(), 1, s.size(), f); bytes += s.size(); }
+    }
+    Metrics::get().bytesWritten(path, bytes);
+    return fclose(f) == 0;
 }
 
-static double remainingBalance(const Policy &p, const PaymentService &paySvc) {
-    double total = p.getPremium() * p.getDuration();
-    double paid  = paySvc.totalPaid(p.getPolicyId());
-    return max(0.0, total - paid);
+static void csvInt(string &out, long long v) {
+    char b[24];
+    out.append(b, (size_t)(to_chars(b, b + sizeof(b), v).ptr - b));
 }
+static void csvMoney(string &out, Money m) { char b[32]; out.append(b, moneyToChars(b, m)); }
+static void csvDate(string &out, Date d) { char b[16]; out.append(b, dateToChars(b, d)); }
 
-//Reports Step 4 ,polymorphism
-class Report {
-public:
-    virtual ~Report() {}
-    virtual void generate() = 0;  // polymorphic interface
-};
 
-class AllClientsReport : public Report {
-    const ClientService &cs;
+//Server mode: the app stays loaded and answers a line protocol on a Unix
+// domain socket (see Application::serve). POSIX only.
+#ifndef _WIN32
+// Accept loop; every connection runs handle(in, out) on its own thread.
+// When stop is set, open connections are shut down and run() waits for them.
+class LocalServer {
+    string path;
+    int listenFd = -1;
+    mutex mu;
+    condition_variable drained;
+    set<int> open;
 public:
-    AllClientsReport(const ClientService &c) : cs(c) {}
-    void generate() override {
-        cout << left << setw(8) << "ID" << setw(22) << "Name" << setw(6) << "Age"
-             << setw(15) << "Contact" << "Address\n";
-        for (auto &c : cs.getAll()) {
-            cout << left << setw(8) << c.getId() << setw(22) << c.getName()
-                 << setw(6) << c.getAge() << setw(15) << c.getContact()
-                 << c.getAddress() << "\n";
-        }
+    explicit LocalServer(const string &p) : path(p) {}
+    ~LocalServer() {
+        if (listenFd < 0) return;
+        ::close(listenFd);
+        ::unlink(path.c_str());
     }
-};
+    LocalServer(const LocalServer&) = delete;
+    LocalServer& operator=(const LocalServer&) = delete;
 
-class AllPoliciesReport : public Report {
-    const PolicyService &ps;
-public:
-    AllPoliciesReport(const PolicyService &p) : ps(p) {}
-    void generate() override {
-        cout << left << setw(10) << "PolicyID" << setw(8) << "Client" << setw(12) << "Type"
-             << setw(12) << "Premium" << setw(10) << "Months" << setw(12) << "Start" << "\n";
-        for (auto &p : ps.getAll()) {
-            cout << left << setw(10) << p.getPolicyId() << setw(8) << p.getClientId()
-                 << setw(12) << p.getType() << setw(12) << (long double)p.getPremium()
-                 << setw(10) << p.getDuration() << setw(12) << p.getStartDate() << "\n";
+    bool listen(string &why) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) { why = "socket path too long"; return false; }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) { why = strerror(errno); return false; }
+        ::unlink(path.c_str());   // stale socket from an earlier run
+        if (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listenFd, 64) < 0) {
+            why = strerror(errno);
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
         }
+        return true;
     }
-};
 
-class ExpiringPoliciesReport : public Report {
-    const PolicyService &ps;
-    const ClientService &cs;
-    int N;
-public:
-    ExpiringPoliciesReport(const PolicyService &p, const ClientService &c, int n)
-        : ps(p), cs(c), N(n) {}
-    void generate() override {
-        Date now = todayApprox();
-        Date endWindow = addMonths(now, N);
-        cout << "Window End: " << dateToString(endWindow) << "\n";
-        cout << left << setw(10) << "PolicyID" << setw(8) << "Client" << setw(22) << "ClientName"
-             << setw(12) << "EndDate" << "\n";
-        for (auto &p : ps.getAll()) {
-            Date ed;
-            if (!PolicyService::policyEndDate(p, ed)) continue;
-            if (cmpDate(now, ed) <= 0 && cmpDate(ed, endWindow) <= 0) {
-                const Client *cptr = nullptr;
-                for (auto &c : cs.getAll()) if (c.getId()==p.getClientId()) { cptr = &c; break; }
-                string cname = cptr ? cptr->getName() : "[Unknown]";
-                cout << left << setw(10) << p.getPolicyId() << setw(8) << p.getClientId()
-                     << setw(22) << cname << setw(12) << dateToString(ed) << "\n";
-            }
+    template <class Handler>
+    void run(const atomic<bool> &stop, Handler handle) {
+        while (!stop) {
+            pollfd pfd{listenFd, POLLIN, 0};
+            if (::poll(&pfd, 1, 200) <= 0) continue;
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+            { lock_guard<mutex> lk(mu); open.insert(fd); }
+            thread([this, fd, handle] {
+                FILE *in = fdopen(fd, "r");
+                int wfd = ::dup(fd);
+                FILE *out = wfd < 0 ? nullptr : fdopen(wfd, "w");
+                if (in && out) handle(in, out);
+                {
+                    lock_guard<mutex> lk(mu);
+                    open.erase(fd);   // before close, so a reused fd number is not dropped
+                    drained.notify_all();
+                }
+                if (out) fclose(out); else if (wfd >= 0) ::close(wfd);
+                if (in) fclose(in); else ::close(fd);
+            }).detach();
         }
+        unique_lock<mutex> lk(mu);
+        for (int fd : open) ::shutdown(fd, SHUT_RDWR);
+        drained.wait(lk, [this] { return open.empty(); });
     }
 };
 
-class UnpaidClientsReport : public Report {
-    const PolicyService &ps;
-    const ClientService &cs;
-    const PaymentService &pay;
-public:
-    UnpaidClientsReport(const PolicyService &p, const ClientService &c, const PaymentService &pm)
-        : ps(p), cs(c), pay(pm) {}
-    void generate() override {
-        cout << left << setw(8) << "Client" << setw(22) << "Name"
-             << setw(12) << "PolicyID" << setw(12) << "Remaining" << "\n";
-        for (auto &p : ps.getAll()) {
-            double rem = remainingBalance(p, pay);
-            if (rem > 1e-9) {
-                const Client *cptr = nullptr;
-                for (auto &c : cs.getAll()) if (c.getId()==p.getClientId()) { cptr = &c; break; }
-                string cname = cptr ? cptr->getName() : "[Unknown]";
-                cout << left << setw(8) << p.getClientId() << setw(22) << cname
-                     << setw(12) << p.getPolicyId() << setw(12) << (long double)rem << "\n";
-            }
-        }
-    }
-};
+static atomic<bool> gServerStop{false};
+static void onServerSignal(int) { gServerStop = true; }
+#endif
 
 
 //My main menu displayed
+static const size_t kSearchLimit = 50;   // rows shown per name search
+static const char *kMetricsFile = "metrics.json";   // written on exit
+
 class Application {
+    PolicyStatusCache statusCache;   // declared first: the services hold a pointer to it
     ClientService clientSvc;
     PolicyService policySvc;
     PaymentService paymentSvc;
+    shared_mutex storeLock;   // server mode: shared for reads, exclusive for writes
+    StorageMode storage;
+
+    PolicyStatus statusOf(const Policy &p) {
+        return statusCache.get(p, paymentSvc.totalPaid(p.getPolicyKey()));
+    }
+
+    // Deferred services may still hold pending changes on menu entry.
+    void tickStorage() {
+        clientSvc.tick(); policySvc.tick(); paymentSvc.tick();
+    }
+    bool storageDue() const {
+        return clientSvc.dueForFlush() || policySvc.dueForFlush() || paymentSvc.dueForFlush();
+    }
 
 public:
-    Application() : clientSvc("clients.txt"), policySvc("policies.txt"), paymentSvc("payments.txt") {}
+    Application(StorageMode mode = StorageMode::Journaled, FlushPolicy fp = FlushPolicy())
+        : clientSvc("clients.txt", mode, fp, false), policySvc("policies.txt", mode, fp, false),
+          paymentSvc("payments.txt", mode, fp, false), storage(mode) {
+        // The tables are independent, so load them side by side.
+        thread c([this] { clientSvc.load(); });
+        thread p([this] { policySvc.load(); });
+        paymentSvc.load();
+        c.join();
+        p.join();
+        policySvc.setStatusCache(&statusCache);
+        paymentSvc.setStatusCache(&statusCache);
+    }
+    ~Application() {
+        clientSvc.flush(); policySvc.flush(); paymentSvc.flush();
+        ofstream out(kMetricsFile);
+        Metrics::get().writeJson(out);
+    }
 
     //Client Management
     void addClient() {
@@ -619,7 +4052,7 @@ public:
     void viewClient() {
         cout << "Enter Client ID: ";
         int id; cin >> id;
-        Client* c = clientSvc.findById(id);
+        const Client* c = clientSvc.findById(id);
         if (!c) { cout << "[ERR] Client not found.\n"; return; }
         cout << "== Client ==\n";
         cout << "ID: " << c->getId() << "\nName: " << c->getName() << "\nAge: " << c->getAge()
@@ -627,30 +4060,34 @@ public:
     }
 
     void searchClient() {
-        cout << "Search by 1) ID  2) Name : ";
+        cout << "Search by 1) ID  2) Name  3) Name prefix : ";
         int ch; cin >> ch;
         if (ch == 1) {
             cout << "Enter ID: "; int id; cin >> id;
-            Client* c = clientSvc.findById(id);
+            const Client* c = clientSvc.findById(id);
             if (!c) { cout << "[ERR] Client not found.\n"; return; }
             cout << c->getId() << " | " << c->getName() << " | Age " << c->getAge()
                  << " | " << c->getContact() << " | " << c->getAddress() << "\n";
         } else {
-            cout << "Enter name keyword: ";
+            cout << (ch == 3 ? "Enter name prefix: " : "Enter name keyword: ");
             string s; cin.ignore(numeric_limits<streamsize>::max(), '\n'); getline(cin, s);
-            auto res = clientSvc.findByName(s);
+            auto res = ch == 3 ? clientSvc.findByNamePrefix(s, kSearchLimit + 1)
+                               : clientSvc.findByName(s, kSearchLimit + 1);
             if (res.empty()) { cout << "[INFO] No matches.\n"; return; }
-            for (auto *c : res) {
+            for (size_t i = 0; i < res.size() && i < kSearchLimit; ++i) {
+                const Client *c = res[i];
                 cout << c->getId() << " | " << c->getName() << " | Age " << c->getAge()
                      << " | " << c->getContact() << " | " << c->getAddress() << "\n";
             }
+            if (res.size() > kSearchLimit)
+                cout << "[INFO] Showing first " << kSearchLimit << " matches; refine the search.\n";
         }
     }
 
     void updateClient() {
         cout << "Enter Client ID to update: ";
         int id; cin >> id;
-        Client* c = clientSvc.findById(id);
+        const Client* c = clientSvc.findById(id);
         if (!c) { cout << "[ERR] Client not found.\n"; return; }
         cout << "Leave empty to keep existing. Press ENTER after prompts.\n";
         cout << "Name (" << c->getName() << "): ";
@@ -672,7 +4109,7 @@ public:
     void deleteClient() {
         cout << "Enter Client ID to delete: ";
         int id; cin >> id;
-        bool hasPolicies = !policySvc.findByClientId(id).empty();
+        bool hasPolicies = policySvc.hasPoliciesFor(id);
         if (!clientSvc.removeClient(id, hasPolicies))
             cout << "[ERR] Cannot delete: either not found or client has policies.\n";
         else
@@ -681,6 +4118,7 @@ public:
 
     void clientMenu() {
         while (true) {
+            tickStorage();
             cout << "\n== Client Management ==\n"
                  << "1) Add Client\n2) View Client\n3) Search Client\n4) Update Client\n5) Delete Client\n0) Back\n> ";
             int ch; cin >> ch;
@@ -698,8 +4136,8 @@ public:
 
     // Policy Management 
     void addPolicy() {
-        int clientId; string type, start;
-        double premium; int months;
+        int clientId; string type, start, premStr;
+        int months;
 
         cout << "Client ID: ";
         cin >> clientId;
@@ -710,7 +4148,7 @@ public:
         getline(cin, type);
 
         cout << "Monthly Premium: ";
-        cin >> premium;
+        cin >> premStr;
 
         cout << "Duration (months): ";
         cin >> months;
@@ -719,6 +4157,8 @@ public:
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
         getline(cin, start);
 
+        Money premium;
+        if (!parseMoney(premStr, premium)) { cout << "[ERR] Invalid premium amount.\n"; return; }
         string pid;
         if (policySvc.addPolicy(clientId, type, premium, months, start, pid))
             cout << "[OK] Policy created: " << pid << "\n";
@@ -728,7 +4168,8 @@ public:
 
     void viewAllPolicies() {
         AllPoliciesReport rpt(policySvc);
-        rpt.generate();
+        Report &r = rpt;
+        r.generate();
     }
 
     void searchPolicy() {
@@ -737,19 +4178,19 @@ public:
         if (ch == 1) {
             cout << "Enter Policy ID (e.g., P1001): ";
             string pid; cin >> pid;
-            Policy* p = policySvc.findByPolicyId(pid);
+            const Policy* p = policySvc.findByPolicyId(pid);
             if (!p) { cout << "[ERR] Policy not found.\n"; return; }
-            cout << p->getPolicyId() << " | " << p->getType() << " | Premium " << p->getPremium()
+            cout << p->getPolicyId() << " | " << p->getType() << " | Premium " << moneyToString(p->getPremium())
                  << " | Months " << p->getDuration() << " | Client " << p->getClientId()
-                 << " | Start " << p->getStartDate() << "\n";
+                 << " | Start " << dateToString(p->getStartDate()) << "\n";
         } else {
             cout << "Enter Client ID: ";
             int cid; cin >> cid;
             auto v = policySvc.findByClientId(cid);
             if (v.empty()) { cout << "[INFO] No policies for client.\n"; return; }
             for (auto *p : v) {
-                cout << p->getPolicyId() << " | " << p->getType() << " | Premium " << p->getPremium()
-                     << " | Months " << p->getDuration() << " | Start " << p->getStartDate() << "\n";
+                cout << p->getPolicyId() << " | " << p->getType() << " | Premium " << moneyToString(p->getPremium())
+                     << " | Months " << p->getDuration() << " | Start " << dateToString(p->getStartDate()) << "\n";
             }
         }
     }
@@ -757,18 +4198,18 @@ public:
     void updatePolicy() {
         cout << "Enter Policy ID to update: ";
         string pid; cin >> pid;
-        Policy* p = policySvc.findByPolicyId(pid);
+        const Policy* p = policySvc.findByPolicyId(pid);
         if (!p) { cout << "[ERR] Policy not found.\n"; return; }
 
         cout << "Leave empty to keep existing (type/premium/months/startDate).\n";
         cout << "Type (" << p->getType() << "): ";
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
         string type; getline(cin, type);
-        cout << "Monthly Premium (" << p->getPremium() << "): ";
+        cout << "Monthly Premium (" << moneyToString(p->getPremium()) << "): ";
         string prem; getline(cin, prem);
         cout << "Duration Months (" << p->getDuration() << "): ";
         string months; getline(cin, months);
-        cout << "Start Date (" << p->getStartDate() << "): ";
+        cout << "Start Date (" << dateToString(p->getStartDate()) << "): ";
         string start; getline(cin, start);
 
         if (policySvc.updatePolicy(pid, type, prem, months, start))
@@ -789,6 +4230,7 @@ public:
 
     void policyMenu() {
         while (true) {
+            tickStorage();
             cout << "\n== Policy Management ==\n"
                  << "1) Add Policy\n2) View All Policies\n3) Search Policy\n4) Update Policy\n5) Delete Policy\n0) Back\n> ";
             int ch; cin >> ch;
@@ -808,16 +4250,18 @@ public:
     void recordPayment() {
         cout << "Policy ID: ";
         string pid; cin >> pid;
-        Policy* p = policySvc.findByPolicyId(pid);
+        const Policy* p = policySvc.findByPolicyId(pid);
         if (!p) { cout << "[ERR] Policy not found.\n"; return; }
 
-        double amount; string dateStr;
+        string amountStr, dateStr;
         cout << "Amount: ";
-        cin >> amount;
+        cin >> amountStr;
         cout << "Payment Date (YYYY-MM-DD): ";
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
         getline(cin, dateStr);
 
+        Money amount;
+        if (!parseMoney(amountStr, amount)) { cout << "[ERR] Invalid amount.\n"; return; }
         paymentSvc.recordPayment(pid, amount, dateStr);
         cout << "[OK] Payment recorded.\n";
     }
@@ -825,68 +4269,63 @@ public:
     void showPaymentHistory() {
         cout << "Policy ID: ";
         string pid; cin >> pid;
-        Policy* p = policySvc.findByPolicyId(pid);
+        const Policy* p = policySvc.findByPolicyId(pid);
         if (!p) { cout << "[ERR] Policy not found.\n"; return; }
 
         auto v = paymentSvc.findByPolicyId(pid);
         if (v.empty()) { cout << "[INFO] No payments.\n"; return; }
         cout << "Date        | Amount\n";
         for (auto &pm : v) {
-            cout << setw(12) << pm.getDate() << " | " << (long double)pm.getAmount() << "\n";
+            cout << setw(12) << dateToString(pm.getDate()) << " | " << moneyToString(pm.getAmount()) << "\n";
         }
     }
 
     void calcNextDueOrRemaining() {
         cout << "Policy ID: ";
         string pid; cin >> pid;
-        Policy* p = policySvc.findByPolicyId(pid);
+        const Policy* p = policySvc.findByPolicyId(pid);
         if (!p) { cout << "[ERR] Policy not found.\n"; return; }
 
         cout << "== Balance & Due ==\n";
-        cout << "Monthly Premium: " << p->getPremium() << "\n";
+        cout << "Monthly Premium: " << moneyToString(p->getPremium()) << "\n";
         cout << "Duration: " << p->getDuration() << " months\n";
-        cout << "Start: " << p->getStartDate() << "\n";
-
-        double total = p->getPremium() * p->getDuration();
-        double paid  = paymentSvc.totalPaid(p->getPolicyId());
-        cout << "Total Due (full term): " << (long double)total << "\n";
-        cout << "Total Paid: " << (long double)paid << "\n";
-        int mp = approxMonthsPaid(p->getPremium(), paid);
-        cout << "Months Paid (approx): " << mp << " / " << p->getDuration() << "\n";
-        Date due;
-        if (nextDueDate(*p, paymentSvc, due)) {
-            cout << "Next Due Date: " << dateToString(due) << "\n";
+        cout << "Start: " << dateToString(p->getStartDate()) << "\n";
+
+        PolicyStatus st = statusOf(*p);
+        cout << "Total Due (full term): " << moneyToString(st.totalDue) << "\n";
+        cout << "Total Paid: " << moneyToString(st.paid) << "\n";
+        cout << "Months Paid (approx): " << st.monthsPaid << " / " << p->getDuration() << "\n";
+        if (st.nextDue.valid()) {
+            cout << "Next Due Date: " << dateToString(st.nextDue) << "\n";
         } else {
             cout << "No further dues (fully paid or invalid start date).\n";
         }
-        cout << "Remaining Balance: " << (long double)remainingBalance(*p, paymentSvc) << "\n";
+        cout << "Remaining Balance: " << moneyToString(st.remaining) << "\n";
     }
 
     void policyStatusReport() {
         cout << "Policy ID: ";
         string pid; cin >> pid;
-        Policy* p = policySvc.findByPolicyId(pid);
+        const Policy* p = policySvc.findByPolicyId(pid);
         if (!p) { cout << "[ERR] Policy not found.\n"; return; }
-        Client* c = clientSvc.findById(p->getClientId());
+        const Client* c = clientSvc.findById(p->getClientId());
         cout << "== Policy Status ==\n";
         if (c) cout << "Client: " << c->getId() << " - " << c->getName() << "\n";
         else   cout << "Client: " << p->getClientId() << " - [Unknown]\n";
-        cout << "Type: " << p->getType() << " | Premium: " << (long double)p->getPremium()
-             << " | Duration: " << p->getDuration() << " | Start: " << p->getStartDate() << "\n";
-        double total = p->getPremium() * p->getDuration();
-        double paid  = paymentSvc.totalPaid(p->getPolicyId());
-        cout << "Total Due (full term): " << (long double)total << "\n";
-        cout << "Total Paid: " << (long double)paid << "\n";
-        cout << "Months Paid (approx): " << approxMonthsPaid(p->getPremium(), paid)
-             << " / " << p->getDuration() << "\n";
-        Date due;
-        if (nextDueDate(*p, paymentSvc, due)) cout << "Next Due Date: " << dateToString(due) << "\n";
+        cout << "Type: " << p->getType() << " | Premium: " << moneyToString(p->getPremium())
+             << " | Duration: " << p->getDuration() << " | Start: " << dateToString(p->getStartDate()) << "\n";
+        PolicyStatus st = statusOf(*p);
+        cout << "Total Due (full term): " << moneyToString(st.totalDue) << "\n";
+        cout << "Total Paid: " << moneyToString(st.paid) << "\n";
+        cout << "Months Paid (approx): " << st.monthsPaid << " / " << p->getDuration() << "\n";
+        if (st.nextDue.valid()) cout << "Next Due Date: " << dateToString(st.nextDue) << "\n";
         else cout << "Next Due Date: N/A (complete or invalid)\n";
-        cout << "Remaining Balance: " << (long double)remainingBalance(*p, paymentSvc) << "\n";
+        cout << "Remaining Balance: " << moneyToString(st.remaining) << "\n";
     }
 
     void paymentsMenu() {
         while (true) {
+            tickStorage();
             cout << "\n== Premium Payments / Status ==\n"
                  << "1) Record Payment\n2) Show Payment History\n3) Next Due / Remaining Balance\n4) Policy Status Report\n0) Back\n> ";
             int ch; cin >> ch;
@@ -901,44 +4340,433 @@ public:
         }
     }
 
-    // Reports
+    // Reports (1-7 as listed in the menu); nullptr for anything else. from only
+    // applies to the cash-flow projection (invalid = this month).
+    unique_ptr<Report> makeReport(int which, int months, Date from = Date::invalid()) const {
+        if (!validReportMonths(months)) return nullptr;
+        switch (which) {
+            case 1: return make_unique<AllClientsReport>(clientSvc);
+            case 2: return make_unique<AllPoliciesReport>(policySvc);
+            case 3: return make_unique<ExpiringPoliciesReport>(policySvc, clientSvc, months);
+            case 4: return make_unique<UnpaidClientsReport>(policySvc, clientSvc, paymentSvc);
+            case 5: return make_unique<PortfolioTotalsReport>(policySvc, paymentSvc);
+            case 6: return make_unique<ReceivablesAgingReport>(policySvc, paymentSvc);
+            case 7: return make_unique<CashFlowProjectionReport>(policySvc, paymentSvc, months, from);
+            default: return nullptr;
+        }
+    }
+
+    // Window start for the cash-flow projection; "-" or a bad date = this month.
+    static Date askMonth() {
+        cout << "First month (YYYY-MM-DD, - for this month): ";
+        string s; cin >> s;
+        Date d;
+        return parseDate(s, d) ? d : Date::invalid();
+    }
+
+    void exportReport() {
+        cout << "Report (1-7): ";
+        int which; cin >> which;
+        int N = 0;
+        Date from = Date::invalid();
+        if (which == 3 || which == 7) { cout << "Enter N (months): "; cin >> N; }
+        if (!validReportMonths(N)) { cout << "[ERR] N must be 0-" << kMaxReportMonths << ".\n"; return; }
+        if (which == 7) from = askMonth();
+        cout << "Format (table/csv/jsonl): ";
+        string fmt; cin >> fmt;
+        cout << "Output file (- for screen): ";
+        string path; cin >> path;
+        if (!runReport(which, N, fmt, path == "-" ? "" : path, from)) cout << "[ERR] Export failed.\n";
+        else if (path != "-") cout << "[OK] Report written to " << path << "\n";
+    }
+
+    // Writes one report in the given format to path (empty = stdout).
+    bool runReport(int which, int months, const string &fmt, const string &path, Date from = Date::invalid()) {
+        SinkFormat f;
+        unique_ptr<Report> rpt = makeReport(which, months, from);
+        if (!rpt || !parseSinkFormat(fmt, f)) return false;
+        unique_ptr<RowSink> out = makeSink(f, path);
+        if (!out->isOpen()) return false;
+        rpt->generate(*out);
+        return true;
+    }
+
+    //Bulk import/export
+    // Policies: policyId,type,premium,months,clientId,start. An empty
+    // policyId gets a new id; a given one must not be taken yet.
+    bool importPolicies(const string &path, const string &rejectPath, ImportResult &res) {
+        static OpStats &stats = Metrics::get().op("import.policies"); OpTimer t(stats);
+        auto parse = [this](const array<string_view, 6> &f, size_t n, Policy &p, string &why) {
+            Money prem;
+            int months, cid;
+            Date start;
+            uint32_t key;
+            why = n != 6 ? "expected 6 fields"
+                : !fitsRecord(f[0]) ? "invalid policy id"
+                : policyIds().find(f[0], key) && policySvc.view().findByKey(key) ? "policy id already exists"
+                : f[1].empty() || !fitsRecord(f[1]) ? "missing or invalid type"
+                : !parseMoney(f[2], prem) || prem <= 0 ? "invalid premium"
+                : !toInt(f[3], months) || months <= 0 ? "invalid months"
+                : !toInt(f[4], cid) || !clientSvc.view().findById(cid) ? "client not found"
+                : !parseDate(f[5], start) ? "invalid start date" : "";
+            if (!why.empty()) return false;
+            if (!f[0].empty()) p.setPolicyId(f[0]);
+            p.setType(f[1]); p.setPremium(prem); p.setDuration(months);
+            p.setClientId(cid); p.setStartDate(start);
+            return true;
+        };
+        auto apply = [this](vector<ImportRow<Policy>> &good, vector<ImportReject> &bad) -> size_t {
+            unordered_set<uint32_t> seen;
+            vector<Policy> batch;
+            vector<size_t> from;   // batch row -> good row
+            batch.reserve(good.size());
+            from.reserve(good.size());
+            for (size_t i = 0; i < good.size(); ++i) {
+                uint32_t key = good[i].row.getPolicyKey();
+                if (key && !seen.insert(key).second) {
+                    bad.push_back(ImportReject{good[i].line, string(good[i].text), "duplicate policy id"});
+                    continue;
+                }
+                batch.push_back(good[i].row);
+                from.push_back(i);
+            }
+            // Rows can still fail here (e.g. a client removed since the round
+            // was parsed): drop each one the batch names and retry the rest.
+            string why;
+            size_t badRow;
+            while (!policySvc.addPolicies(batch, clientSvc, why, &badRow)) {
+                const ImportRow<Policy> &g = good[from[badRow]];
+                bad.push_back(ImportReject{g.line, string(g.text), why});
+                batch.erase(batch.begin() + badRow);
+                from.erase(from.begin() + badRow);
+            }
+            return batch.size();
+        };
+        // Rounds follow block cuts and timing, so ids given anywhere in the
+        // file are reserved first: a blank-id row never takes one a later row brings.
+        forEachCsvFirstField(path, [this](string_view pid) { policySvc.reserveId(pid); });
+        return importCsv<Policy, 6>(path, rejectPath, "policyId", parse, apply, res);
+    }
+
+    // Payments: policyId,amount,date. The policy must exist.
+    bool importPayments(const string &path, const string &rejectPath, ImportResult &res) {
+        static OpStats &stats = Metrics::get().op("import.payments"); OpTimer t(stats);
+        auto parse = [this](const array<string_view, 3> &f, size_t n, Payment &pm, string &why) {
+            uint32_t key = 0;
+            Money amount;
+            Date dt;
+            why = n != 3 ? "expected 3 fields"
+                : !policyIds().find(f[0], key) || !policySvc.view().findByKey(key) ? "policy not found"
+                : !parseMoney(f[1], amount) ? "invalid amount"
+                : !parseDate(f[2], dt) ? "invalid date" : "";
+            if (!why.empty()) return false;
+            pm = Payment(key, amount, dt);
+            return true;
+        };
+        auto apply = [this](vector<ImportRow<Payment>> &good, vector<ImportReject> &bad) -> size_t {
+            vector<Payment> batch;
+            vector<size_t> from;   // batch row -> good row
+            batch.reserve(good.size());
+            from.reserve(good.size());
+            for (size_t i = 0; i < good.size(); ++i) {
+                batch.push_back(good[i].row);
+                from.push_back(i);
+            }
+            // As for policies: reject only the row the batch names, keep the rest.
+            string why;
+            size_t badRow;
+            while (!paymentSvc.recordPayments(batch, policySvc, why, &badRow)) {
+                const ImportRow<Payment> &g = good[from[badRow]];
+                bad.push_back(ImportReject{g.line, string(g.text), why});
+                batch.erase(batch.begin() + badRow);
+                from.erase(from.begin() + badRow);
+            }
+            return batch.size();
+        };
+        return importCsv<Payment, 3>(path, rejectPath, "policyId", parse, apply, res);
+    }
+
+    // Same columns the imports read (clients: id,name,age,contact,address).
+    bool exportTable(const string &which, const string &path) {
+        OpStats &stats = Metrics::get().op("export." + which); OpTimer t(stats);
+        if (which == "clients") {
+            ClientService::View v = clientSvc.pin();
+            return exportCsv(path, "id,name,age,contact,address", v.rows.size(), [&](size_t i, string &out) {
+                const Client &c = v.rows[i];
+                csvInt(out, c.getId()); out.push_back(',');
+                csvField(out, c.getName()); out.push_back(',');
+                csvInt(out, c.getAge()); out.push_back(',');
+                csvField(out, c.getContact()); out.push_back(',');
+                csvField(out, c.getAddress());
+            });
+        }
+        if (which == "policies") {
+            PolicyService::View v = policySvc.pin();
+            return exportCsv(path, "policyId,type,premium,months,clientId,start", v.rows.size(), [&](size_t i, string &out) {
+                const Policy &p = v.rows[i];
+                csvField(out, p.getPolicyId()); out.push_back(',');
+                csvField(out, p.getType()); out.push_back(',');
+                csvMoney(out, p.getPremium()); out.push_back(',');
+                csvInt(out, p.getDuration()); out.push_back(',');
+                csvInt(out, p.getClientId()); out.push_back(',');
+                csvDate(out, p.getStartDate());
+            });
+        }
+        if (which == "payments") {
+            PaymentService::View v = paymentSvc.pin();
+            return exportCsv(path, "policyId,amount,date", v.policyKeys.size(), [&](size_t i, string &out) {
+                csvField(out, policyIds().str(v.policyKeys[i])); out.push_back(',');
+                csvMoney(out, v.amounts[i]); out.push_back(',');
+                csvDate(out, v.dates[i]);
+            });
+        }
+        return false;
+    }
+
+    // Ad-hoc query as a report (see parseQuery); null, with why set, if the
+    // text does not parse.
+    unique_ptr<Report> makeQuery(string_view text, string &why) const {
+        Query q;
+        if (!parseQuery(text, q, why)) return nullptr;
+        return make_unique<QueryReport>(policySvc, paymentSvc, move(q));
+    }
+
+    bool runQuery(string_view text, const string &fmt, const string &path, string &why) {
+        SinkFormat f;
+        if (!parseSinkFormat(fmt, f)) { why = "unknown format"; return false; }
+        unique_ptr<Report> rpt = makeQuery(text, why);
+        if (!rpt) return false;
+        unique_ptr<RowSink> out = makeSink(f, path);
+        if (!out->isOpen()) { why = "cannot open output"; return false; }
+        rpt->generate(*out);
+        return true;
+    }
+
+    void queryPrompt() {
+        cout << "Query (e.g. policies type=Health and premium>500 sort premium desc limit 10):\n> ";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        string text, why;
+        getline(cin, text);
+        unique_ptr<Report> rpt = makeQuery(text, why);
+        if (!rpt) { cout << "[ERR] " << why << "\n"; return; }
+        rpt->generate();
+    }
+
     void reportsMenu() {
         while (true) {
+            tickStorage();
             cout << "\n== Reports ==\n"
-                 << "1) List All Clients\n2) List All Policies\n3) Policies Expiring in Next N Months\n4) Clients with Unpaid Premiums\n0) Back\n> ";
+                 << "1) List All Clients\n2) List All Policies\n3) Policies Expiring in Next N Months\n4) Clients with Unpaid Premiums\n5) Portfolio Totals by Type\n6) Receivables Aging\n7) Cash-flow Projection by Month\n8) Export Report (table/CSV/JSONL)\n9) Ad-hoc Query\n0) Back\n> ";
             int ch; cin >> ch;
-            switch (ch) {
-                case 1: {
-                    AllClientsReport rpt(clientSvc);
-                    Report &r = rpt;      // polymorphic call
-                    r.generate();
-                } break;
-                case 2: {
-                    AllPoliciesReport rpt(policySvc);
-                    Report &r = rpt;
-                    r.generate();
-                } break;
-                case 3: {
-                    cout << "Enter N (months): ";
-                    int N; cin >> N;
-                    ExpiringPoliciesReport rpt(policySvc, clientSvc, N);
-                    Report &r = rpt;
-                    r.generate();
-                } break;
-                case 4: {
-                    UnpaidClientsReport rpt(policySvc, clientSvc, paymentSvc);
-                    Report &r = rpt;
-                    r.generate();
-                } break;
-                case 0: return;
-                default: cout << "Invalid choice.\n"; break;
+            if (ch == 0) return;
+            if (ch == 8) { exportReport(); continue; }
+            if (ch == 9) { queryPrompt(); continue; }
+            int N = 0;
+            Date from = Date::invalid();
+            if (ch == 3 || ch == 7) { cout << "Enter N (months): "; cin >> N; }
+            if (!validReportMonths(N)) { cout << "[ERR] N must be 0-" << kMaxReportMonths << ".\n"; continue; }
+            if (ch == 7) from = askMonth();
+            unique_ptr<Report> rpt = makeReport(ch, N, from);
+            if (!rpt) { cout << "Invalid choice.\n"; continue; }
+            Report &r = *rpt;      // polymorphic call
+            r.generate();
+        }
+    }
+
+#ifndef _WIN32
+    // Server protocol: one request per line, fields separated by '|'. Every
+    // response is "OK" or "ERR <reason>", body lines (never empty), then an
+    // empty line.
+    bool handleRead(const array<string_view, 5> &f, size_t n, FILE *out) {
+        string_view cmd = f[0];
+        auto ok = [&] { fputs("OK\n", out); };
+        auto line = [&](string_view l) { fwrite(l.data(), 1, l.size(), out); fputc('\n', out); };
+        auto fail = [&](const char *why) { fprintf(out, "ERR %s\n", why); return true; };
+        int id;
+        if (cmd == "PING") { ok(); return true; }
+        if (cmd == "CLIENT") {
+            const Client *c = n > 1 && toInt(f[1], id) ? clientSvc.findById(id) : nullptr;
+            if (!c) return fail("client not found");
+            ok(); line(c->toRecord());
+            return true;
+        }
+        if (cmd == "FIND") {
+            if (n < 2 || f[1].empty()) return fail("usage: FIND|name");
+            ok();
+            for (const Client *c : clientSvc.findByName(string(f[1]), kSearchLimit)) line(c->toRecord());
+            return true;
+        }
+        if (cmd == "POLICY") {
+            const Policy *p = n > 1 ? policySvc.findByPolicyId(f[1]) : nullptr;
+            if (!p) return fail("policy not found");
+            ok(); line(p->toRecord());
+            return true;
+        }
+        if (cmd == "POLICIES") {
+            if (n < 2 || !toInt(f[1], id)) return fail("usage: POLICIES|clientId");
+            ok();
+            for (const Policy *p : policySvc.findByClientId(id)) line(p->toRecord());
+            return true;
+        }
+        if (cmd == "PAYMENTS") {
+            if (n < 2 || !policySvc.findByPolicyId(f[1])) return fail("policy not found");
+            ok();
+            for (auto &pm : paymentSvc.findByPolicyId(f[1])) line(pm.toRecord());
+            return true;
+        }
+        if (cmd == "STATUS") {
+            const Policy *p = n > 1 ? policySvc.findByPolicyId(f[1]) : nullptr;
+            if (!p) return fail("policy not found");
+            PolicyStatus st = statusOf(*p);
+            ok();
+            line("policy=" + string(p->getPolicyId()));
+            line("client=" + to_string(p->getClientId()));
+            line("totalDue=" + moneyToString(st.totalDue));
+            line("totalPaid=" + moneyToString(st.paid));
+            line("monthsPaid=" + to_string(st.monthsPaid));
+            line("nextDue=" + (st.nextDue.valid() ? dateToString(st.nextDue) : string("N/A")));
+            line("endDate=" + (st.end.valid() ? dateToString(st.end) : string("N/A")));
+            line("remaining=" + moneyToString(st.remaining));
+            return true;
+        }
+        if (cmd == "METRICS") {
+            ostringstream js;
+            Metrics::get().writeJson(js);
+            ok(); line(js.str());
+            return true;
+        }
+        return false;
+    }
+
+    // REPORT|1-7[|months][|table|csv|jsonl][|from]. The report pins its tables under
+    // the read lock and is generated after releasing it, so a long report
+    // never holds up PAY.
+    void handleReport(const array<string_view, 5> &f, size_t n, FILE *out) {
+        int which = 0, months = 12;
+        SinkFormat fmt = SinkFormat::Table;
+        unique_ptr<Report> rpt;
+        if (n > 1 && toInt(f[1], which)) {
+            if (n > 2 && !f[2].empty() && (!toInt(f[2], months) || !validReportMonths(months))) {
+                fprintf(out, "ERR months must be 0-%d\n", kMaxReportMonths);
+                return;
             }
+            if (n > 3 && !f[3].empty() && !parseSinkFormat(f[3], fmt)) { fputs("ERR unknown format\n", out); return; }
+            Date from = Date::invalid();
+            if (n > 4 && !parseDate(f[4], from)) { fputs("ERR invalid date\n", out); return; }
+            shared_lock<shared_mutex> rl(storeLock);
+            rpt = makeReport(which, months, from);
         }
+        if (!rpt) { fputs("ERR usage: REPORT|1-7[|months][|format][|from]\n", out); return; }
+        fputs("OK\n", out);
+        unique_ptr<RowSink> sink = makeSink(fmt, out);
+        rpt->generate(*sink);
     }
 
+    // QUERY|text[|table|csv|jsonl]. Planned and pinned under the read lock,
+    // run after releasing it (as REPORT).
+    void handleQuery(const array<string_view, 5> &f, size_t n, FILE *out) {
+        SinkFormat fmt = SinkFormat::Table;
+        if (n < 2) { fputs("ERR usage: QUERY|text[|format]\n", out); return; }
+        if (n > 2 && !f[2].empty() && !parseSinkFormat(f[2], fmt)) { fputs("ERR unknown format\n", out); return; }
+        string why;
+        unique_ptr<Report> rpt;
+        {
+            shared_lock<shared_mutex> rl(storeLock);
+            rpt = makeQuery(f[1], why);
+        }
+        if (!rpt) { fprintf(out, "ERR %s\n", why.c_str()); return; }
+        fputs("OK\n", out);
+        unique_ptr<RowSink> sink = makeSink(fmt, out);
+        rpt->generate(*sink);
+    }
+
+    void handleRequest(string_view req, FILE *out) {
+        array<string_view, 5> f;
+        size_t n = splitFields(req, f);
+        if (f[0] == "PAY") {
+            // PAY|policyId|amount[|YYYY-MM-DD]
+            unique_lock<shared_mutex> wl(storeLock);
+            Money amount;
+            if (n < 3 || !policySvc.findByPolicyId(f[1])) fputs("ERR policy not found\n", out);
+            else if (!parseMoney(f[2], amount)) fputs("ERR invalid amount\n", out);
+            else {
+                paymentSvc.recordPayment(f[1], amount, n > 3 ? string(f[3]) : string());
+                fputs("OK\n", out);
+            }
+        } else if (f[0] == "REPORT") {
+            handleReport(f, n, out);
+        } else if (f[0] == "QUERY") {
+            handleQuery(f, n, out);
+        } else if (f[0] == "FLUSH") {
+            unique_lock<shared_mutex> wl(storeLock);
+            clientSvc.flush(); policySvc.flush(); paymentSvc.flush();
+            fputs("OK\n", out);
+        } else {
+            shared_lock<shared_mutex> rl(storeLock);
+            if (!handleRead(f, n, out)) fputs("ERR unknown command\n", out);
+        }
+        fputc('\n', out);
+        fflush(out);
+    }
+
+    void serveConnection(FILE *in, FILE *out) {
+        char *buf = nullptr;
+        size_t cap = 0;
+        ssize_t len;
+        while ((len = getline(&buf, &cap, in)) > 0) {
+            string_view req = trimView(string_view(buf, (size_t)len));
+            if (req.empty()) continue;
+            if (req == "QUIT") break;
+            // A bad request must cost its own reply, never the daemon.
+            try {
+                handleRequest(req, out);
+            } catch (const exception &e) {
+                fprintf(out, "ERR %s\n\n", e.what());
+                fflush(out);
+            }
+        }
+        free(buf);
+    }
+
+    // Serves until SIGINT/SIGTERM; pending Deferred changes are flushed on a
+    // timer here, since no menu loop is running. The timer only checks under
+    // the shared lock and takes the exclusive one when a flush is due.
+    int serve(const string &socketPath) {
+        LocalServer server(socketPath);
+        string why;
+        if (!server.listen(why)) { cerr << "[ERR] Cannot listen on " << socketPath << ": " << why << "\n"; return 1; }
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, onServerSignal);
+        signal(SIGTERM, onServerSignal);
+        cout << "[OK] Serving on " << socketPath << "\n" << flush;
+        thread flusher;
+        if (storage == StorageMode::Deferred) flusher = thread([this] {
+            while (!gServerStop) {
+                this_thread::sleep_for(chrono::milliseconds(100));
+                {
+                    shared_lock<shared_mutex> rl(storeLock);
+                    if (!storageDue()) continue;
+                }
+                unique_lock<shared_mutex> wl(storeLock);
+                tickStorage();
+            }
+        });
+        server.run(gServerStop, [this](FILE *in, FILE *out) { serveConnection(in, out); });
+        if (flusher.joinable()) flusher.join();
+        cout << "[INFO] Server stopped.\n";
+        return 0;
+    }
+#else
+    int serve(const string &) {
+        cerr << "[ERR] Server mode needs Unix domain sockets (not available on this platform).\n";
+        return 1;
+    }
+#endif
+
     // MAIN MENU
     void run() {
         while (true) {
+            tickStorage();
             cout << "\n==============================\n";
             cout << "Insurance Policy Management\n";
             cout << "==============================\n";
@@ -946,6 +4774,7 @@ public:
             cout << "2) Policy Management\n";
             cout << "3) Premium Payments / Status\n";
             cout << "4) Reports\n";
+            cout << "5) Diagnostics (metrics JSON)\n";
             cout << "0) Exit\n> "<< flush;
             int ch;
             if (!(cin >> ch)) break;
@@ -955,6 +4784,7 @@ public:
                 case 2: policyMenu(); break;
                 case 3: paymentsMenu(); break;
                 case 4: reportsMenu(); break;
+                case 5: Metrics::get().writeJson(cout); break;
                 case 0:
                     cout << "Goodbye!\n"; 
                     return;
@@ -966,9 +4796,131 @@ public:
     }
 };
 
-int main() {
+static void usage(const char *prog) {
+    cout << "Usage:\n"
+         << "  " << prog << "                      interactive menu (data files in the working directory)\n"
+         << "  " << prog << " --generate DIR [CLIENTS POLICIES PAYMENTS [SKEW [SEED]]]\n"
+         << "  " << prog << " --bench [ROWS...]     default sizes: 10000 1000000 10000000\n"
+         << "  " << prog << " --report 1-7 [--months N] [--from YYYY-MM-DD] [--format table|csv|jsonl] [--out FILE]\n"
+         << "                               write one report (menu numbering) to FILE or stdout; N <= 1200\n"
+         << "  " << prog << " --query \"TEXT\" [--format table|csv|jsonl] [--out FILE]\n"
+         << "                               e.g. \"policies type=Health and premium>500 sort start desc limit 20\"\n"
+         << "  " << prog << " --serve SOCKET        keep the data loaded and serve requests on a Unix socket\n"
+         << "  " << prog << " --import policies|payments FILE [--rejects FILE]\n"
+         << "                               add CSV rows; bad rows go to FILE.rejected (or --rejects)\n"
+         << "  " << prog << " --export clients|policies|payments FILE\n"
+         << "Storage options (interactive menu, --report, --import and --serve):\n"
+         << "  --storage rewrite|journal|deferred    default: journal\n"
+         << "  --flush-ops N  --flush-ms T           deferred batch limits (default 256 ops / 2000 ms)\n"
+         << "  --fsync                               sync every journal append to disk\n";
+}
+
+int main(int argc, char **argv) {
+    vector<string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--generate") {
+        if (args.size() < 2) { usage(argv[0]); return 1; }
+        GenConfig cfg;
+        size_t seed = cfg.seed;
+        bool ok = args.size() < 5 || (toSize(args[2], cfg.clients) && toSize(args[3], cfg.policies)
+                                      && toSize(args[4], cfg.payments));
+        ok = ok && (args.size() < 6 || (toDouble(args[5], cfg.skew) && cfg.skew > 0));
+        ok = ok && (args.size() < 7 || toSize(args[6], seed));
+        if (!ok) { usage(argv[0]); return 1; }
+        cfg.seed = seed;
+        generateDataset(args[1], cfg);
+        cout << "[OK] Generated " << cfg.clients << " clients, " << cfg.policies << " policies, "
+             << cfg.payments << " payments in " << args[1] << "\n";
+        return 0;
+    }
+    if (!args.empty() && args[0] == "--bench") {
+        vector<size_t> sizes;
+        for (size_t i = 1; i < args.size(); ++i) {
+            size_t n;
+            if (!toSize(args[i], n)) { usage(argv[0]); return 1; }
+            sizes.push_back(n);
+        }
+        if (sizes.empty()) sizes = {10000, 1000000, 10000000};
+        cout << left << setw(32) << "Operation" << setw(12) << "Rows" << setw(10) << "Ops"
+             << setw(14) << "Total(ms)" << "ns/op\n";
+        for (size_t n : sizes) runBenchmark(n);
+        return 0;
+    }
+    StorageMode mode = StorageMode::Journaled;
+    FlushPolicy fp;
+    int report = 0, months = 12;
+    Date from = Date::invalid();
+    string format = "table", outPath, socketPath;
+    string queryText;
+    string importWhat, importPath, rejectPath, exportWhat, exportPath;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string &a = args[i];
+        bool hasValue = i + 1 < args.size();
+        size_t n;
+        if (a == "--fsync") fp.fsync = true;
+        else if (a == "--report" && hasValue && toInt(args[i + 1], report)) ++i;
+        else if (a == "--months" && hasValue && toInt(args[i + 1], months) && validReportMonths(months)) ++i;
+        else if (a == "--from" && hasValue && parseDate(args[i + 1], from)) ++i;
+        else if (a == "--format" && hasValue) format = args[++i];
+        else if (a == "--out" && hasValue) outPath = args[++i];
+        else if (a == "--serve" && hasValue) socketPath = args[++i];
+        else if (a == "--query" && hasValue) queryText = args[++i];
+        else if (a == "--import" && i + 2 < args.size()) { importWhat = args[++i]; importPath = args[++i]; }
+        else if (a == "--export" && i + 2 < args.size()) { exportWhat = args[++i]; exportPath = args[++i]; }
+        else if (a == "--rejects" && hasValue) rejectPath = args[++i];
+        else if (a == "--storage" && hasValue) {
+            const string &v = args[++i];
+            if (v == "rewrite") mode = StorageMode::Rewrite;
+            else if (v == "journal") mode = StorageMode::Journaled;
+            else if (v == "deferred") mode = StorageMode::Deferred;
+            else { usage(argv[0]); return 1; }
+        }
+        else if (a == "--flush-ops" && hasValue && toSize(args[i + 1], n)) { fp.maxOps = max<size_t>(1, n); ++i; }
+        else if (a == "--flush-ms" && hasValue && toSize(args[i + 1], n)) {
+            fp.maxDelay = chrono::milliseconds(min(n, kMaxFlushDelayMs));
+            ++i;
+        }
+        else { usage(argv[0]); return 1; }
+    }
+
+    if (!socketPath.empty()) {
+        Application app(mode, fp);
+        return app.serve(socketPath);
+    }
+    if (!importPath.empty()) {
+        if (importWhat != "policies" && importWhat != "payments") { usage(argv[0]); return 1; }
+        Application app(mode, fp);
+        ImportResult res;
+        if (rejectPath.empty()) rejectPath = importPath + ".rejected";
+        bool ok = importWhat == "policies" ? app.importPolicies(importPath, rejectPath, res)
+                                           : app.importPayments(importPath, rejectPath, res);
+        if (!ok) { cerr << "[ERR] Cannot read " << importPath << " or write " << rejectPath << ".\n"; return 1; }
+        cout << "[OK] Imported " << res.imported << " " << importWhat << ", rejected " << res.rejected;
+        if (!res.rejectPath.empty()) cout << " (see " << res.rejectPath << ")";
+        cout << "\n";
+        return 0;
+    }
+    if (!exportPath.empty()) {
+        Application app(mode, fp);
+        if (app.exportTable(exportWhat, exportPath)) { cout << "[OK] Exported " << exportWhat << " to " << exportPath << "\n"; return 0; }
+        cerr << "[ERR] Unknown table or cannot write " << exportPath << ".\n";
+        return 1;
+    }
+    if (!queryText.empty()) {
+        Application app(mode, fp);
+        string why;
+        if (app.runQuery(queryText, format, outPath, why)) return 0;
+        cerr << "[ERR] " << why << "\n";
+        return 1;
+    }
+    if (report) {
+        Application app(mode, fp);
+        if (app.runReport(report, months, format, outPath, from)) return 0;
+        cerr << "[ERR] Unknown report/format or cannot open output.\n";
+        return 1;
+    }
+
     cin.tie(&cout);
-    Application app;
+    Application app(mode, fp);
     app.run();
     return 0;
 }